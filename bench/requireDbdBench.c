@@ -0,0 +1,209 @@
+/*
+ * Benchmark of loading module dbd files as text and through the dbd cache.
+ *
+ * Generates modules whose dbd files are copies of an expanded dbd file, like
+ * softIoc.dbd of EPICS base, with one device support of their own, the way
+ * module dbd files repeat the menus and record types of base. The modules
+ * are required after that dbd file is loaded, once for each way of loading,
+ * each one in a new process:
+ *   text    requireDbdCache=0, dbLoadDatabase() parses every file as a whole
+ *   split   the files are split and definitions already loaded are skipped
+ *   cold    like split, writing the split files into REQUIRE_CACHE_DIR
+ *   cached  like split, reading the split files from REQUIRE_CACHE_DIR
+ *
+ * Usage: requireDbdBench <expanded dbd file> [<modules>] [<tmpdir>]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* nftw */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <dbAccess.h>
+#include <epicsTime.h>
+#include <epicsExport.h>
+
+#include "require.h"
+
+#ifndef EPICSVERSION
+#error EPICSVERSION must be defined
+#endif
+#ifndef T_A
+#error T_A must be defined
+#endif
+
+extern REGISTRAR pvar_func_requireRegister;
+extern int requireDbdCache;
+
+static int make_dirs(char *path)
+{
+        char *p;
+
+        for (p = path + 1; *p; p++)
+        {
+                if (*p != '/') continue;
+                *p = '\0';
+                if (mkdir(path, 0777) != 0 && access(path, F_OK) != 0) return -1;
+                *p = '/';
+        }
+        return mkdir(path, 0777) != 0 && access(path, F_OK) != 0 ? -1 : 0;
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf)
+{
+        return remove(path);
+}
+
+/*
+ * Module b<i> version 1.0.0 with the dbd text and a device support.
+ */
+static int make_module(const char *root, int i, const char *dbd, size_t size)
+{
+        char path[512];
+        FILE *file;
+
+        snprintf(path, sizeof(path), "%s/b%d/1.0.0/" EPICSVERSION "/lib/" T_A, root, i);
+        if (make_dirs(path) != 0) return -1;
+        snprintf(path, sizeof(path), "%s/b%d/1.0.0/" EPICSVERSION "/lib/" T_A "/b%d.dep", root, i, i);
+        if (!(file = fopen(path, "w"))) return -1;
+        fclose(file);
+        snprintf(path, sizeof(path), "%s/b%d/1.0.0/" EPICSVERSION "/dbd", root, i);
+        if (make_dirs(path) != 0) return -1;
+        snprintf(path, sizeof(path), "%s/b%d/1.0.0/" EPICSVERSION "/dbd/b%d.dbd", root, i, i);
+        if (!(file = fopen(path, "w"))) return -1;
+        fwrite(dbd, 1, size, file);
+        fprintf(file, "\ndevice(ai,CONSTANT,devBench%d,\"bench%d\")\n", i, i);
+        return fclose(file);
+}
+
+/*
+ * Require all modules in a new process and report the time.
+ */
+static int run(const char *name, const char *basedbd, int modules, int cache, const char *cachedir)
+{
+        epicsTimeStamp start, end;
+        char module[16];
+        FILE *out;
+        pid_t pid;
+        int status;
+        int i;
+
+        fflush(stdout);
+        if ((pid = fork()) < 0)
+        {
+                perror("requireDbdBench: fork");
+                return -1;
+        }
+        if (pid > 0)
+        {
+                if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                        fprintf(stderr, "requireDbdBench: %s failed\n", name);
+                        return -1;
+                }
+                return 0;
+        }
+
+        /*
+         * Keep the messages of require out of the results. The modules have
+         * no library with a register function, require reports that after
+         * loading the dbd file.
+         */
+        out = fdopen(dup(1), "w");
+        if (!out || !freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr)) _exit(1);
+        requireDbdCache = cache;
+        if (cachedir) setenv("REQUIRE_CACHE_DIR", cachedir, 1);
+        pvar_func_requireRegister();
+        if (dbLoadDatabase(basedbd, NULL, NULL) != 0)
+        {
+                fprintf(out, "requireDbdBench: can't load %s\n", basedbd);
+                _exit(1);
+        }
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < modules; i++)
+        {
+                snprintf(module, sizeof(module), "b%d", i);
+                require_priv(module, "1.0.0");
+        }
+        epicsTimeGetCurrent(&end);
+        fprintf(out, "%-8s %5d modules %9.3f s %9.3f ms/module\n", name, modules,
+                epicsTimeDiffInSeconds(&end, &start),
+                epicsTimeDiffInSeconds(&end, &start) * 1000 / modules);
+        fclose(out);
+        _exit(0);
+}
+
+int main(int argc, char **argv)
+{
+        char root[256], tree[300], cachedir[300];
+        const char *basedbd;
+        struct stat filestat;
+        char *dbd;
+        FILE *file;
+        int modules;
+        int status = 0;
+        int i;
+
+        if (argc < 2)
+        {
+                fprintf(stderr, "Usage: requireDbdBench <expanded dbd file> [<modules>] [<tmpdir>]\n");
+                return 2;
+        }
+        basedbd = argv[1];
+        modules = argc > 2 ? atoi(argv[2]) : 50;
+        if (modules <= 0)
+        {
+                fprintf(stderr, "requireDbdBench: bad number of modules %s\n", argv[2]);
+                return 2;
+        }
+        if (stat(basedbd, &filestat) != 0 || !(dbd = malloc(filestat.st_size)) ||
+            !(file = fopen(basedbd, "r")) || fread(dbd, 1, filestat.st_size, file) != (size_t)filestat.st_size)
+        {
+                perror(basedbd);
+                return 1;
+        }
+        fclose(file);
+
+        snprintf(root, sizeof(root), "%s/requireDbdBenchXXXXXX", argc > 3 ? argv[3] : "/tmp");
+        if (!mkdtemp(root))
+        {
+                perror("requireDbdBench: cannot create directory");
+                return 1;
+        }
+        snprintf(tree, sizeof(tree), "%s/modules", root);
+        snprintf(cachedir, sizeof(cachedir), "%s/cache", root);
+        if (make_dirs(cachedir) != 0)
+        {
+                perror(cachedir);
+                return 1;
+        }
+        for (i = 0; i < modules; i++)
+        {
+                if (make_module(tree, i, dbd, filestat.st_size) != 0)
+                {
+                        perror("requireDbdBench: cannot create module tree");
+                        return 1;
+                }
+        }
+        free(dbd);
+        setenv("EPICS_MODULES_PATH", tree, 1);
+
+        printf("Loading %d modules with dbd files like %s (%ld bytes)\n", modules, basedbd, (long)filestat.st_size);
+        /* The first run only reads the files into the page cache */
+        if (run("warmup", basedbd, modules, 0, NULL) != 0 ||
+            run("text", basedbd, modules, 0, NULL) != 0 ||
+            run("split", basedbd, modules, 1, NULL) != 0 ||
+            run("cold", basedbd, modules, 1, cachedir) != 0 ||
+            run("cached", basedbd, modules, 1, cachedir) != 0)
+        {
+                status = 1;
+        }
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        return status;
+}
@@ -0,0 +1,186 @@
+/*
+ * Benchmark of the discovery of modules linked into the application.
+ *
+ * Loads copies of librequire.so until the process has the given number of
+ * mapped objects and then looks for the release symbols of all of them with
+ * dl_iterate_phdr(), as the first call of require does:
+ *   symtab   findLibRelease(), which reads the mapped dynamic symbol tables
+ *   dlopen   dlopen(), dlsym() and dlclose() on every object, as before
+ * Every tenth copy is named librequire-<n>.so and so is looked up as the
+ * require module, the others are named libobj<n>.so and are not modules,
+ * like most libraries of an IOC. Both methods run once with only the
+ * objects of the benchmark itself and once with all copies loaded.
+ *
+ * Usage: requireLibReleaseBench [<objects>] [<rounds>] [<tmpdir>]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* nftw, dladdr, dl_iterate_phdr */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <sys/stat.h>
+
+#include <epicsTime.h>
+#include <epicsExport.h>
+
+#include "require.h"
+
+extern REGISTRAR pvar_func_requireRegister;
+
+/* The dl_iterate_phdr() callback of require, not in require.h */
+extern int findLibRelease(struct dl_phdr_info *info, size_t size, void *data);
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf)
+{
+        return remove(path);
+}
+
+static int count_object(struct dl_phdr_info *info, size_t size, void *data)
+{
+        (*(int *)data)++;
+        return 0;
+}
+
+static int count_objects(void)
+{
+        int count = 0;
+
+        dl_iterate_phdr(count_object, &count);
+        return count;
+}
+
+/*
+ * The callback require used before findLibRelease() read the symbol tables.
+ */
+static int dlopenLibRelease(struct dl_phdr_info *info, size_t size, void *data)
+{
+        char symname[80];
+        const char *p;
+        void *handle;
+        size_t len;
+
+        if (!info->dlpi_name || !info->dlpi_name[0]) return 0;
+        p = strrchr(info->dlpi_name, '/');
+        p = p ? p + 1 : info->dlpi_name;
+        if (strncmp(p, "lib", 3) == 0) p += 3;
+        len = strcspn(p, ".-");
+        snprintf(symname, sizeof(symname), "epics_%.*sLibRelease", (int)len, p);
+        handle = dlopen(info->dlpi_name, RTLD_NOW | RTLD_GLOBAL);
+        if (handle && dlsym(handle, symname)) (*(int *)data)++;
+        if (handle) dlclose(handle);
+        return 0;
+}
+
+static int copy_file(const char *from, const char *to)
+{
+        char buffer[65536];
+        FILE *in, *out;
+        size_t n;
+        int status = 0;
+
+        if (!(in = fopen(from, "rb"))) return -1;
+        if (!(out = fopen(to, "wb")))
+        {
+                fclose(in);
+                return -1;
+        }
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        {
+                if (fwrite(buffer, 1, n, out) != n) status = -1;
+        }
+        if (ferror(in)) status = -1;
+        fclose(in);
+        if (fclose(out) != 0) status = -1;
+        return status;
+}
+
+/*
+ * Run both methods for the given number of rounds and report the mean time
+ * of one pass over all objects.
+ */
+static void run(int rounds)
+{
+        epicsTimeStamp start, end;
+        int objects = count_objects();
+        int found = 0;
+        double seconds;
+        int r;
+
+        epicsTimeGetCurrent(&start);
+        for (r = 0; r < rounds; r++)
+        {
+                dl_iterate_phdr(findLibRelease, NULL);
+        }
+        epicsTimeGetCurrent(&end);
+        seconds = epicsTimeDiffInSeconds(&end, &start) / rounds;
+        printf("symtab %5d objects %9.3f ms/pass %9.3f us/object\n",
+                objects, seconds * 1e3, seconds * 1e6 / objects);
+
+        epicsTimeGetCurrent(&start);
+        for (r = 0; r < rounds; r++)
+        {
+                dl_iterate_phdr(dlopenLibRelease, &found);
+        }
+        epicsTimeGetCurrent(&end);
+        seconds = epicsTimeDiffInSeconds(&end, &start) / rounds;
+        printf("dlopen %5d objects %9.3f ms/pass %9.3f us/object (%d modules)\n",
+                objects, seconds * 1e3, seconds * 1e6 / objects, found / rounds);
+}
+
+int main(int argc, char **argv)
+{
+        char root[256], path[512];
+        Dl_info lib;
+        int objects = argc > 1 ? atoi(argv[1]) : 300;
+        int rounds = argc > 2 ? atoi(argv[2]) : 20;
+        int status = 0;
+        int i;
+
+        if (objects <= 0 || rounds <= 0)
+        {
+                fprintf(stderr, "Usage: requireLibReleaseBench [<objects>] [<rounds>] [<tmpdir>]\n");
+                return 2;
+        }
+        if (!dladdr((void *)require_priv, &lib) || !lib.dli_fname)
+        {
+                fprintf(stderr, "requireLibReleaseBench: can't find librequire.so\n");
+                return 1;
+        }
+        snprintf(root, sizeof(root), "%s/requireLibReleaseBenchXXXXXX", argc > 3 ? argv[3] : "/tmp");
+        if (!mkdtemp(root))
+        {
+                perror("requireLibReleaseBench: cannot create directory");
+                return 1;
+        }
+
+        /* Registers the modules linked into the benchmark */
+        pvar_func_requireRegister();
+        run(rounds);
+
+        for (i = 0; count_objects() < objects; i++)
+        {
+                if (i % 10 == 0) snprintf(path, sizeof(path), "%s/librequire-%d.so", root, i);
+                else snprintf(path, sizeof(path), "%s/libobj%d.so", root, i);
+                if (copy_file(lib.dli_fname, path) != 0)
+                {
+                        perror("requireLibReleaseBench: cannot copy library");
+                        status = 1;
+                        break;
+                }
+                if (!dlopen(path, RTLD_NOW | RTLD_LOCAL))
+                {
+                        fprintf(stderr, "requireLibReleaseBench: %s\n", dlerror());
+                        status = 1;
+                        break;
+                }
+        }
+        if (status == 0) run(rounds);
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        return status;
+}
@@ -0,0 +1,193 @@
+/*
+ * Benchmark of probing module trees without module index.
+ *
+ * Generates modules with many versions each and requires all of them, once
+ * for each probing method selected with REQUIRE_PROBE, each time in a new
+ * process:
+ *   auto     io_uring or threads, one at a time if the first stat is fast
+ *   serial   one stat after the other
+ *   threads  the probe threads
+ *   uring    io_uring, or threads where the kernel has none
+ * Every method runs on a cold cache, after the dentries and inodes have been
+ * dropped with /proc/sys/vm/drop_caches, which needs root, and on a warm one.
+ * Put <tmpdir> on NFS to see the effect of round trips.
+ *
+ * Usage: requireProbeBench [<modules>] [<versions>] [<tmpdir>]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* nftw */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <epicsTime.h>
+#include <epicsExport.h>
+
+#include "require.h"
+
+#ifndef EPICSVERSION
+#error EPICSVERSION must be defined
+#endif
+#ifndef T_A
+#error T_A must be defined
+#endif
+
+extern REGISTRAR pvar_func_requireRegister;
+
+static int make_dirs(char *path)
+{
+        char *p;
+
+        for (p = path + 1; *p; p++)
+        {
+                if (*p != '/') continue;
+                *p = '\0';
+                if (mkdir(path, 0777) != 0 && access(path, F_OK) != 0) return -1;
+                *p = '/';
+        }
+        return mkdir(path, 0777) != 0 && access(path, F_OK) != 0 ? -1 : 0;
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf)
+{
+        return remove(path);
+}
+
+/*
+ * Module p<i> with versions 1.0.0 to 1.<versions-1>.0, each with db and
+ * startup folders.
+ */
+static int make_module(const char *root, int i, int versions)
+{
+        char path[512];
+        FILE *dep;
+        int j;
+
+        for (j = 0; j < versions; j++)
+        {
+                snprintf(path, sizeof(path), "%s/p%d/1.%d.0/db", root, i, j);
+                if (make_dirs(path) != 0) return -1;
+                snprintf(path, sizeof(path), "%s/p%d/1.%d.0/startup", root, i, j);
+                if (make_dirs(path) != 0) return -1;
+                snprintf(path, sizeof(path), "%s/p%d/1.%d.0/" EPICSVERSION "/lib/" T_A, root, i, j);
+                if (make_dirs(path) != 0) return -1;
+                snprintf(path, sizeof(path), "%s/p%d/1.%d.0/" EPICSVERSION "/lib/" T_A "/p%d.dep", root, i, j, i);
+                if (!(dep = fopen(path, "w"))) return -1;
+                fclose(dep);
+        }
+        return 0;
+}
+
+/*
+ * Returns 0 if the caches were dropped.
+ */
+static int drop_caches(void)
+{
+        FILE *file;
+
+        sync();
+        if (!(file = fopen("/proc/sys/vm/drop_caches", "w"))) return -1;
+        fputs("2\n", file);
+        return fclose(file);
+}
+
+/*
+ * Require all modules in a new process and report the time.
+ */
+static int run(const char *method, int cold, int modules)
+{
+        epicsTimeStamp start, end;
+        char module[16];
+        FILE *out;
+        pid_t pid;
+        int status;
+        int i;
+
+        if (cold && drop_caches() != 0) return 0;
+        fflush(stdout);
+        if ((pid = fork()) < 0)
+        {
+                perror("requireProbeBench: fork");
+                return -1;
+        }
+        if (pid > 0)
+        {
+                if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                        fprintf(stderr, "requireProbeBench: %s failed\n", method);
+                        return -1;
+                }
+                return 0;
+        }
+
+        /* Keep the messages of require out of the results */
+        out = fdopen(dup(1), "w");
+        if (!out || !freopen("/dev/null", "w", stdout)) _exit(1);
+        if (strcmp(method, "auto") != 0) setenv("REQUIRE_PROBE", method, 1);
+        pvar_func_requireRegister();
+        epicsTimeGetCurrent(&start);
+        for (i = 0; i < modules; i++)
+        {
+                snprintf(module, sizeof(module), "p%d", i);
+                if (require_priv(module, NULL) != 0) _exit(1);
+        }
+        epicsTimeGetCurrent(&end);
+        fprintf(out, "%-8s %-5s %5d modules %9.3f s %9.3f ms/module\n", method, cold ? "cold" : "warm",
+                modules, epicsTimeDiffInSeconds(&end, &start),
+                epicsTimeDiffInSeconds(&end, &start) * 1000 / modules);
+        fclose(out);
+        _exit(0);
+}
+
+int main(int argc, char **argv)
+{
+        static const char *methods[] = { "auto", "serial", "threads", "uring" };
+        char root[256], tree[300];
+        int modules = argc > 1 ? atoi(argv[1]) : 100;
+        int versions = argc > 2 ? atoi(argv[2]) : 20;
+        int status = 0;
+        int i, cold;
+
+        if (modules <= 0 || versions <= 0)
+        {
+                fprintf(stderr, "Usage: requireProbeBench [<modules>] [<versions>] [<tmpdir>]\n");
+                return 2;
+        }
+        snprintf(root, sizeof(root), "%s/requireProbeBenchXXXXXX", argc > 3 ? argv[3] : "/tmp");
+        if (!mkdtemp(root))
+        {
+                perror("requireProbeBench: cannot create directory");
+                return 1;
+        }
+        snprintf(tree, sizeof(tree), "%s/modules", root);
+        for (i = 0; i < modules; i++)
+        {
+                if (make_module(tree, i, versions) != 0)
+                {
+                        perror("requireProbeBench: cannot create module tree");
+                        return 1;
+                }
+        }
+        setenv("EPICS_MODULES_PATH", tree, 1);
+
+        printf("Requiring %d modules with %d versions each\n", modules, versions);
+        if (drop_caches() != 0)
+        {
+                printf("Can't drop caches, not running as root, warm runs only\n");
+        }
+        for (cold = 1; cold >= 0; cold--)
+        {
+                for (i = 0; i < (int)(sizeof(methods)/sizeof(methods[0])); i++)
+                {
+                        if (run(methods[i], cold, modules) != 0) status = 1;
+                }
+        }
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        return status;
+}
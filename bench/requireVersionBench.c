@@ -0,0 +1,89 @@
+/*
+ * Microbenchmark of version requirements.
+ *
+ * Checks generated versions against requirements of every form with
+ * requireVersionMatch(), which compiles the requirement and checks one
+ * version, and sorts the versions with requireVersionCompare(), as the
+ * requireVersion tool does.
+ *
+ * Usage: requireVersionBench [<versions>] [<rounds>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsTime.h>
+
+#include "require.h"
+
+static const char *specs[] = {
+        "", "1.2.3", "1.2", "1.2.3+", "1.2+", "=1.2.3", ">=1.2.3", ">1.2",
+        "<1.2.3", "<=1.2", "~1.2.3", "^1.2.3", "^0.2.3", "test",
+};
+
+static int compare(const void *a, const void *b)
+{
+        return requireVersionCompare(*(const char * const *)a, *(const char * const *)b);
+}
+
+int main(int argc, char **argv)
+{
+        epicsTimeStamp start, end;
+        char **versions, **sorted;
+        int count = argc > 1 ? atoi(argv[1]) : 1000;
+        int rounds = argc > 2 ? atoi(argv[2]) : 100;
+        long checks = 0, matches = 0;
+        double seconds;
+        int i, j, r;
+
+        if (count <= 0 || rounds <= 0)
+        {
+                fprintf(stderr, "Usage: requireVersionBench [<versions>] [<rounds>]\n");
+                return 2;
+        }
+        versions = malloc(count * sizeof(char *));
+        sorted = malloc(count * sizeof(char *));
+        if (!versions || !sorted) return 1;
+        for (i = 0; i < count; i++)
+        {
+                /* Mostly numbered versions in random order, some named */
+                versions[i] = malloc(32);
+                if (!versions[i]) return 1;
+                if (i % 50 == 49) sprintf(versions[i], "test%d", i);
+                else sprintf(versions[i], "%d.%d.%d", rand() % 3, rand() % 10, rand() % 20);
+        }
+
+        epicsTimeGetCurrent(&start);
+        for (r = 0; r < rounds; r++)
+        {
+                for (j = 0; j < (int)(sizeof(specs)/sizeof(specs[0])); j++)
+                {
+                        for (i = 0; i < count; i++)
+                        {
+                                matches += requireVersionMatch(specs[j], versions[i]) == 1;
+                                checks++;
+                        }
+                }
+        }
+        epicsTimeGetCurrent(&end);
+        seconds = epicsTimeDiffInSeconds(&end, &start);
+        printf("match   %9ld checks %9.3f s %9.1f ns/check (%ld matches)\n",
+                checks, seconds, seconds * 1e9 / checks, matches);
+
+        epicsTimeGetCurrent(&start);
+        for (r = 0; r < rounds; r++)
+        {
+                memcpy(sorted, versions, count * sizeof(char *));
+                qsort(sorted, count, sizeof(char *), compare);
+        }
+        epicsTimeGetCurrent(&end);
+        seconds = epicsTimeDiffInSeconds(&end, &start);
+        printf("sort    %9d versions %7.3f s %9.1f us/sort\n",
+                count, seconds, seconds * 1e6 / rounds);
+
+        for (i = 0; i < count; i++) free(versions[i]);
+        free(versions);
+        free(sorted);
+        return 0;
+}
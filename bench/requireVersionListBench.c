@@ -0,0 +1,214 @@
+/*
+ * Benchmark of version enumeration.
+ *
+ * Generates one module with thousands of installed versions and requires it
+ * with requests of every form, each time in a new process:
+ *   latest   no version, the highest one
+ *   major    the highest version of a major release
+ *   minor    the highest patch of a minor release
+ *   plus     the highest version of a major release from a minor one on
+ *   exact    one version in the middle
+ * Every request runs once with the versions found by scanning the module
+ * directory and once with the versions taken from the module index, which
+ * leaves mostly the sorting and searching of the version list.
+ *
+ * Usage: requireVersionListBench [<versions>] [<rounds>] [<tmpdir>]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* nftw */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <epicsTime.h>
+#include <epicsExport.h>
+
+#include "require.h"
+
+#ifndef EPICSVERSION
+#error EPICSVERSION must be defined
+#endif
+#ifndef T_A
+#error T_A must be defined
+#endif
+
+extern REGISTRAR pvar_func_requireRegister;
+
+static int make_dirs(char *path)
+{
+        char *p;
+
+        for (p = path + 1; *p; p++)
+        {
+                if (*p != '/') continue;
+                *p = '\0';
+                if (mkdir(path, 0777) != 0 && access(path, F_OK) != 0) return -1;
+                *p = '/';
+        }
+        return mkdir(path, 0777) != 0 && access(path, F_OK) != 0 ? -1 : 0;
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf)
+{
+        return remove(path);
+}
+
+/*
+ * Version i of the generated module, 50 patches per minor release and 20
+ * minor releases per major release.
+ */
+static void version_name(char *version, size_t size, int i)
+{
+        snprintf(version, size, "%d.%d.%d", i / 1000, i / 50 % 20, i % 50);
+}
+
+/*
+ * Module v with the given number of versions, each with a dependency file
+ * and a db folder, and the module index of the tree, written as
+ * module_manager.py does. With index 0 no index is written.
+ */
+static int make_module(const char *root, int versions, int index)
+{
+        char path[512], version[32];
+        struct timeval times[2];
+        FILE *file, *idx = NULL;
+        int i;
+
+        if (index)
+        {
+                snprintf(path, sizeof(path), "%s/.require.index", root);
+                if (!(idx = fopen(path, "w"))) return -1;
+                fprintf(idx, "# require module index 1\n");
+        }
+        for (i = 0; i < versions; i++)
+        {
+                version_name(version, sizeof(version), i);
+                snprintf(path, sizeof(path), "%s/v/%s/db", root, version);
+                if (make_dirs(path) != 0) return -1;
+                snprintf(path, sizeof(path), "%s/v/%s/" EPICSVERSION "/lib/" T_A, root, version);
+                if (make_dirs(path) != 0) return -1;
+                snprintf(path, sizeof(path), "%s/v/%s/" EPICSVERSION "/lib/" T_A "/v.dep", root, version);
+                if (!(file = fopen(path, "w"))) return -1;
+                fclose(file);
+                if (idx) fprintf(idx, "v %s " EPICSVERSION " " T_A " db\n", version);
+        }
+        if (idx && fclose(idx) != 0) return -1;
+
+        /* The index is only used for modules older than the index */
+        gettimeofday(&times[0], NULL);
+        times[0].tv_sec -= 100;
+        times[0].tv_usec = 0;
+        times[1] = times[0];
+        snprintf(path, sizeof(path), "%s/v", root);
+        return utimes(path, times);
+}
+
+/*
+ * Require v in a new process for each round and report the mean time.
+ */
+static int run(const char *root, const char *source, const char *request, const char *version, int rounds)
+{
+        double seconds = 0;
+        int pipefd[2];
+        pid_t pid;
+        int status;
+        int r;
+
+        for (r = 0; r < rounds; r++)
+        {
+                epicsTimeStamp start, end;
+                double elapsed;
+
+                fflush(stdout);
+                if (pipe(pipefd) != 0 || (pid = fork()) < 0)
+                {
+                        perror("requireVersionListBench: fork");
+                        return -1;
+                }
+                if (pid == 0)
+                {
+                        close(pipefd[0]);
+                        /* Keep the messages of require out of the results */
+                        if (!freopen("/dev/null", "w", stdout)) _exit(1);
+                        setenv("EPICS_MODULES_PATH", root, 1);
+                        pvar_func_requireRegister();
+                        epicsTimeGetCurrent(&start);
+                        if (require_priv("v", version) != 0) _exit(1);
+                        epicsTimeGetCurrent(&end);
+                        elapsed = epicsTimeDiffInSeconds(&end, &start);
+                        if (write(pipefd[1], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) _exit(1);
+                        _exit(0);
+                }
+                close(pipefd[1]);
+                if (read(pipefd[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) elapsed = -1;
+                close(pipefd[0]);
+                if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || elapsed < 0)
+                {
+                        fprintf(stderr, "requireVersionListBench: %s %s failed\n", source, request);
+                        return -1;
+                }
+                seconds += elapsed;
+        }
+        printf("%-6s %-7s %-10s %9.3f ms/require\n", source, request, version ? version : "",
+                seconds * 1000 / rounds);
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        char root[256], scan[300], indexed[300];
+        char major[32], minor[32], plus[32], exact[32];
+        int versions = argc > 1 ? atoi(argv[1]) : 5000;
+        int rounds = argc > 2 ? atoi(argv[2]) : 10;
+        int status = 0;
+        int i;
+
+        if (versions <= 0 || rounds <= 0)
+        {
+                fprintf(stderr, "Usage: requireVersionListBench [<versions>] [<rounds>] [<tmpdir>]\n");
+                return 2;
+        }
+        snprintf(root, sizeof(root), "%s/requireVersionListBenchXXXXXX", argc > 3 ? argv[3] : "/tmp");
+        if (!mkdtemp(root))
+        {
+                perror("requireVersionListBench: cannot create directory");
+                return 1;
+        }
+        snprintf(scan, sizeof(scan), "%s/scan", root);
+        snprintf(indexed, sizeof(indexed), "%s/index", root);
+        if (make_dirs(scan) != 0 || make_dirs(indexed) != 0 ||
+            make_module(scan, versions, 0) != 0 || make_module(indexed, versions, 1) != 0)
+        {
+                perror("requireVersionListBench: cannot create module tree");
+                nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+                return 1;
+        }
+
+        /* Requests for versions around the middle of the list */
+        i = versions / 2;
+        snprintf(major, sizeof(major), "%d", i / 1000);
+        snprintf(minor, sizeof(minor), "%d.%d", i / 1000, i / 50 % 20);
+        snprintf(plus, sizeof(plus), "%d.%d+", i / 1000, i / 50 % 20);
+        version_name(exact, sizeof(exact), i);
+
+        printf("Requiring a module with %d versions, %d rounds\n", versions, rounds);
+        for (i = 0; i < 2; i++)
+        {
+                const char *dir = i ? indexed : scan;
+                const char *source = i ? "index" : "scan";
+                if (run(dir, source, "latest", NULL, rounds) != 0) status = 1;
+                if (run(dir, source, "major", major, rounds) != 0) status = 1;
+                if (run(dir, source, "minor", minor, rounds) != 0) status = 1;
+                if (run(dir, source, "plus", plus, rounds) != 0) status = 1;
+                if (run(dir, source, "exact", exact, rounds) != 0) status = 1;
+        }
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        return status;
+}
@@ -0,0 +1,28 @@
+#!/bin/bash
+#
+# Run the benchmarks of the require module. The benchmarks are installed next
+# to this script by the module build, call it from there:
+#   <module>/<version>/bench/runbench.sh [<benchmark>...]
+# Without arguments all benchmarks are run. EPICS_BASE must be set.
+
+BENCHMARKS="requireDbdBench requireVersionBench requireProbeBench requireVersionListBench requireLibReleaseBench"
+
+cd "$(dirname "$0")" || exit 1
+export TMPDIR=${TMPDIR:-/tmp}
+
+failed=0
+for bench in ${@:-$BENCHMARKS}
+do
+    echo "=== $bench"
+    case $bench in
+        requireDbdBench) "./$bench" "${EPICS_BASE:?}/dbd/softIoc.dbd" 50 "$TMPDIR" ;;
+        requireVersionBench) "./$bench" ;;
+        requireProbeBench) "./$bench" 100 20 "$TMPDIR" ;;
+        requireVersionListBench) "./$bench" 5000 10 "$TMPDIR" ;;
+        requireLibReleaseBench) "./$bench" 300 20 "$TMPDIR" ;;
+        *.sh) bash "./$bench" ;;
+        *.py) python "./$bench" ;;
+        *) "./$bench" "$TMPDIR" ;;
+    esac || failed=$((failed+1))
+done
+exit $failed
@@ -1,5 +1,4 @@
 #!/usr/bin/env python2.7
-# pylint: disable=eval-used
 #
 # EPICS Environment Manager
 # Copyright (C) 2015 Cosylab
@@ -25,87 +24,123 @@ be evaluated as (XA || XB).
 For example, to exclude 3.15 for version numbers outside the range 1.0 to 2.0, the following arguments would be given:
     --version X --epics-base 3.15 --condition <1.0 --condition >2.0
 
+The conditions are version requirements as for require, where 2.0 stands for
+any 2.0.x, so >2.0 is 2.1.0 or higher. See the README of require.
+
 TODO:
 * Argument to switch between or/and behavior.
 """
 
 from __future__ import print_function
-import collections
+from distutils.spawn import find_executable
 import argparse
+import os
 import re
+import subprocess
+import sys
 import logging
 
-EpicsModule = collections.namedtuple('EpicsModule', 'major minor patch exact')
+INFINITE = (sys.maxsize, sys.maxsize, sys.maxsize)
 
-def module_compare(lhs, rhs, comp):
-    """Compare two modules, lhs and rhs, with comp comparator"""
-    logger = logging.getLogger(__name__)
-    logger.debug('{} {} {} '.format(lhs, comp, rhs))
-    if comp == '<' or comp == '>':
-        return (eval('lhs.major {} rhs.major'.format(comp)) or
-                (lhs.major == rhs.major and eval('lhs.minor {} rhs.minor'.format(comp))) or
-                (lhs.major == rhs.major and lhs.minor == rhs.minor and
-                 eval('lhs.patch {} rhs.patch'.format(comp))))
-    if comp == '<=' or comp == '>=':
-        return (eval('lhs.major {} rhs.major'.format(comp[0])) or
-                (lhs.major == rhs.major and eval('lhs.minor {} rhs.minor'.format(comp[0]))) or
-                (lhs.major == rhs.major and lhs.minor == rhs.minor and
-                 eval('lhs.patch {} rhs.patch'.format(comp[0]))) or
-                (lhs.major == rhs.major and lhs.minor == rhs.minor and lhs.patch == rhs.patch))
-    if comp == '=':
-        return lhs.major == rhs.major and lhs.minor == rhs.minor and lhs.patch == rhs.patch
-
-def version_to_tup(version):
-    """Converts version string on format "MAJOR.MINOR.PATCH" to named tuple. If any
-    value is missing it will be substituted with a zero.
+VERSION_SPEC = re.compile(r'^(>=|<=|[<>=~^]?)(\d+)(?:\.(\d+))?(?:\.(\d+))?(\+?)$')
+
+def bump_version(version, n):
+    """Lowest version above all versions which share the first n parts with version."""
+    return version[:n-1] + (version[n-1] + 1,) + (0,) * (3 - n)
+
+def compile_version(spec):
+    """Compile a version requirement to (low, high, name), the numbered
+    versions from low up to but not including high, or a version name. These
+    are the rules of compile_version() in require.c, see the README of require.
+    Raises ValueError for an invalid requirement.
+    """
+    if not spec:
+        return ((0, 0, 0), INFINITE, None)
+    if spec[0] not in '<>=~^' and not spec[0].isdigit():
+        return (None, None, spec)
+    matches = VERSION_SPEC.match(spec)
+    if matches is None or (matches.group(1) and matches.group(5)):
+        raise ValueError('Invalid version requirement {}'.format(spec))
+    parts = [int(part) for part in matches.group(2, 3, 4) if part is not None]
+    n = len(parts)
+    version = tuple(parts + [0] * (3 - n))
+    comp = matches.group(5) or matches.group(1)
+    if comp in ('', '='):
+        return (version, bump_version(version, n), None)
+    if comp == '+':
+        return (version, INFINITE if n == 1 else bump_version(version, n - 1), None)
+    if comp == '>=':
+        return (version, INFINITE, None)
+    if comp == '>':
+        return (bump_version(version, n), INFINITE, None)
+    if comp == '<':
+        return ((0, 0, 0), version, None)
+    if comp == '<=':
+        return ((0, 0, 0), bump_version(version, n), None)
+    if comp == '~':
+        return (version, bump_version(version, 1 if n == 1 else 2), None)
+    if version[0] > 0 or n == 1:
+        return (version, bump_version(version, 1), None)
+    return (version, bump_version(version, 2 if version[1] > 0 or n == 2 else 3), None)
+
+def version_key(version):
+    """Key for sorting numbered versions, missing parts sort first as in require."""
+    matches = re.match(r'(\d+)(?:\.(\d+))?(?:\.(\d+))?', version)
+    return tuple(-1 if part is None else int(part) for part in matches.groups())
+
+def version_in_range(compiled, version):
+    """Check version against a requirement compiled with compile_version."""
+    low, high, name = compiled
+    if name is not None:
+        return version == name
+    return version[:1].isdigit() and low <= version_key(version) < high
+
+def version_tool():
+    """The requireVersion tool from $REQUIRE_VERSION_TOOL or the PATH, or None."""
+    return os.environ.get('REQUIRE_VERSION_TOOL') or find_executable('requireVersion')
+
+def matching_versions(spec, versions):
+    """Return the numbered versions and the named version which match the
+    requirement spec, lowest first. Uses the requireVersion tool built with
+    require if it is installed and the same rules in Python otherwise.
+    Raises ValueError for an invalid requirement.
     """
-    matches = re.match(r'(0|[1-9][0-9]*)\.(0|[1-9][0-9]*)\.(0|[1-9][0-9]*)(\+?)', version)
-    if matches is not None:
-        return EpicsModule(int(matches.group(1)), int(matches.group(2)), int(matches.group(3)), not matches.group(4) == '+')
-    matches = re.match(r'(0|[1-9][0-9]*)\.(0|[1-9][0-9]*)(\+?)', version)
-    if matches is not None:
-        return EpicsModule(int(matches.group(1)), int(matches.group(2)), 0, not matches.group(3) == '+')
-    matches = re.match(r'(0|[1-9][0-9]*)(\+?)', version)
-    if matches is not None:
-        return EpicsModule(int(matches.group(1)), 0, 0, not matches.group(2) == '+')
-    return EpicsModule(0, 0, 0, False)
+    tool = version_tool()
+    if tool:
+        proc = subprocess.Popen([tool, '--', spec] + list(versions), stdout=subprocess.PIPE,
+                                stderr=subprocess.PIPE, universal_newlines=True)
+        out, err = proc.communicate()
+        if proc.returncode == 2:
+            raise ValueError(err.strip())
+        return out.split()
+    compiled = compile_version(spec)
+    matches = [version for version in versions if version_in_range(compiled, version)]
+    return sorted(matches, key=lambda version: (version[:1].isdigit(), version_key(version) if version[:1].isdigit() else version))
 
 def check(version, conditions):
     """Returns true if any condition is true compared to version, otherwise false"""
     logger = logging.getLogger(__name__)
     matches = re.match(r'(0|[1-9][0-9]*)\.(0|[1-9][0-9]*)\.(0|[1-9][0-9]*)', version)
-    if matches is None or len(matches.groups()) != 3:
+    if matches is None:
         logger.debug('Not valid version ({})'.format(version))
         return False
     for condition in conditions:
-        matches = re.match(r'^([<>]=?|=)([\d\.]*)(\+?)$', condition)
-        if matches is None:
+        # A comparison with a trailing '+' means "at least"
+        matches = re.match(r'^([<>]=?|=)([\d\.]*)\+$', condition)
+        if matches is not None:
+            condition = '>=' + matches.group(2)
+        try:
+            if matching_versions(condition, [version]):
+                logger.debug('True')
+                return True
+        except ValueError:
             logger.warning('Illigal condition ({}) always returns False.'.format(condition))
             return False
-        comp = matches.group(1)
-        rversion = matches.group(2)
-        if len(matches.groups()) == 3 and matches.group(3) == '+':
-            comp = ">="
-        if module_compare(version_to_tup(version), version_to_tup(rversion), comp):
-            logger.debug('True')
-            return True
     return False
 
 def module_match(version, other):
     """This function will return true IFF other is high enough for version."""
-    ver = version_to_tup(version) if isinstance(version, str) else version
-    oth = version_to_tup(other) if isinstance(other, str) else other
-    return ver.major == 0 or (
-        ver.exact and (
-            (ver.minor == 0 and oth.major == ver.major) or
-            (ver.patch == 0 and oth.major == ver.major and oth.minor == ver.minor) or
-            (ver.major == ver.major and oth.minor == ver.minor and oth.patch == ver.patch)
-            )
-        ) or (
-        not ver.exact and (
-            (ver.minor == 0 and oth.major >= ver.major) or
-            (ver.patch == 0 and oth.major == oth.major and oth.minor >= ver.minor) or
-            (oth.major == ver.major and oth.minor == ver.minor and oth.patch >= ver.patch)));
+    return bool(matching_versions(version, [other]))
 
 def main():
     """Main function"""
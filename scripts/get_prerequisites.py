@@ -34,14 +34,7 @@ import argparse
 import os
 import re
 import logging
-from check_excludes import module_match
-
-def module_key(version):
-    """Key for sorting module versions with python built-in sorting algorithms."""
-    ver = version.split('.', 2)
-    if len(ver) == 3:
-        return (int(ver[0]), int(ver[1]), int(ver[2]))
-    return (0, 0, 0)
+from check_excludes import matching_versions
 
 class DependencyResolver(object):
     """Finds EPICS modules dependencies by looking at
@@ -267,10 +260,9 @@ def module_version(module, comp_version='', epics_base_version='', target_arch='
                 installed_versions.add(version)
 
     if installed_versions:
-        sorted_installed_versions = sorted(installed_versions, key=module_key)
-        for version in reversed(sorted_installed_versions):
-            if module_match(comp_version, version):
-                return version
+        matching = matching_versions(comp_version, installed_versions)
+        if matching:
+            return matching[-1]
 
     logger.debug('No version found for module {}'.format(module))
 
@@ -46,6 +46,77 @@ def installed_ta(moduledir):
                     res.append(matches.group(1, 2))
     return res
 
+# Index of all installed modules, read by require. See src/require.c.
+INDEX_FILE = '.require.index'
+INDEX_HEADER = '# require module index 1'
+LIBRARY_NAMES = ('lib{}.so', '{}.dll', '{}Lib.munch')
+
+def module_contents(versiondir, name, epics_ver, arch):
+    """List which of lib, dbd, db, startup, bin and misc a module version
+    provides for the given EPICS version and architecture.
+    """
+    contents = []
+    libdir = os.path.join(versiondir, epics_ver, 'lib', arch)
+    if any(os.path.isfile(os.path.join(libdir, lib.format(name))) for lib in LIBRARY_NAMES):
+        contents.append('lib')
+    dbd = os.path.join(versiondir, epics_ver, 'dbd', '{}.dbd'.format(name))
+    if os.path.isfile(dbd) and os.path.getsize(dbd) > 0:
+        contents.append('dbd')
+    for common in ('db', 'startup'):
+        if os.path.isdir(os.path.join(versiondir, common)):
+            contents.append(common)
+    if os.path.isdir(os.path.join(versiondir, epics_ver, 'bin', arch)):
+        contents.append('bin')
+    if os.path.isdir(os.path.join(versiondir, 'misc')):
+        contents.append('misc')
+    return ','.join(contents) or '-'
+
+def module_entries(prefix, name):
+    """Find every installed version, EPICS version and architecture of the
+    module name below prefix. An architecture is installed if its dep-file
+    exists.
+    """
+    entries = []
+    moduledir = os.path.join(prefix, name)
+    if not os.path.isdir(moduledir):
+        return entries
+    for version in os.listdir(moduledir):
+        versiondir = os.path.join(moduledir, version)
+        if not os.path.isdir(versiondir):
+            continue
+        for epics_ver in os.listdir(versiondir):
+            libdir = os.path.join(versiondir, epics_ver, 'lib')
+            if not os.path.isdir(libdir):
+                continue
+            for arch in os.listdir(libdir):
+                if os.path.isfile(os.path.join(libdir, arch, '{}.dep'.format(name))):
+                    entries.append((name, version, epics_ver, arch,
+                                    module_contents(versiondir, name, epics_ver, arch)))
+    return entries
+
+def index_entries(prefix):
+    """Find every installed module, version, EPICS version and architecture
+    below prefix.
+    """
+    entries = []
+    for name in os.listdir(prefix):
+        entries.extend(module_entries(prefix, name))
+    return sorted(entries)
+
+def update_index(prefix, dry_run=False):
+    """Rewrite the module index in prefix. The new index is written to a
+    temporary file and renamed so that require never sees a partial index.
+    """
+    if dry_run:
+        print('Update module index {}'.format(os.path.join(prefix, INDEX_FILE)))
+        return
+    tmpname = os.path.join(prefix, '{}.{}'.format(INDEX_FILE, os.getpid()))
+    with open(tmpname, 'w') as index:
+        index.write(INDEX_HEADER + '\n')
+        for entry in index_entries(prefix):
+            index.write(' '.join(entry) + '\n')
+    os.rename(tmpname, os.path.join(prefix, INDEX_FILE))
+
 class ModuleManager(object):
     """Install, uninstall or reinstall an EPICS module."""
 
@@ -168,11 +239,12 @@ class ModuleManager(object):
 def main():
     """Main function"""
     parser = argparse.ArgumentParser(description='Install EPICS module')
-    parser.add_argument('action', choices=['install', 'uninstall', 'reinstall'],
+    parser.add_argument('action', choices=['install', 'uninstall', 'reinstall', 'index'],
                         help='Select action to execute. Install will overwrite existing installation. ' \
-			     'Uinstall will remove the version. Reinstall will first uninstall and then install.')
-    parser.add_argument('name', help='Name of EPICS module.')
-    parser.add_argument('version', help='Version of EPICS module.')
+			     'Uinstall will remove the version. Reinstall will first uninstall and then install. ' \
+			     'Index will only rebuild the module index.')
+    parser.add_argument('name', nargs='?', help='Name of EPICS module.')
+    parser.add_argument('version', nargs='?', help='Version of EPICS module.')
     parser.add_argument('--arch', action='append', help='Architecture to install (default install all).')
     parser.add_argument('--prefix', metavar='DIR',
                         help='Installation prefix (default {})'.format(os.environ['EPICS_MODULES_PATH']),
@@ -188,12 +260,20 @@ def main():
                         help='Assume no. Assume that the answer to any question is no.')
     args = parser.parse_args()
 
+    if args.action == 'index':
+        print('Updating module index in {}'.format(args.prefix))
+        update_index(args.prefix, args.dry_run)
+        return
+    if args.name is None or args.version is None:
+        parser.error('name and version are required for {}'.format(args.action))
+
     installer = ModuleManager(args.name, args.version, args.prefix, args.builddir, args.dry_run)
 
     if args.action == 'install':
         print('Installing module {}, version {}'.format(args.name, args.version))
         try:
             installer.install(args.assumeyes)
+            update_index(args.prefix, args.dry_run)
         except Exception as why:
             print('Unable to install: {}'.format(why))
             sys.exit(-1)
@@ -202,6 +282,7 @@ def main():
         try:
             installer.uninstall(args.assumeyes)
             installer.install(args.assumeyes)
+            update_index(args.prefix, args.dry_run)
         except Exception as why:
             print('Unable to reinstall: {}'.format(why))
             sys.exit(-1)
@@ -209,6 +290,7 @@ def main():
         print('Unstalling module {}, version {}'.format(args.name, args.version))
         try:
             installer.uninstall(args.assumeyes)
+            update_index(args.prefix, args.dry_run)
         except Exception as why:
             print('Unable to uninstall: {}'.format(why))
             sys.exit(-1)
@@ -0,0 +1,292 @@
+#!/usr/bin/env python2.7
+
+"""Module resolver shared by all IOCs on a host.
+
+Keeps the module index of the roots in EPICS_MODULES_PATH in memory, kept up
+to date with inotify, and serves it on a Unix socket. require asks for the
+index of a root there before it looks at the file system, so when many IOCs
+boot at once the module tree is scanned once instead of once per IOC.
+
+A client sends the root and the serial of the index it has, or '-', followed
+by a newline. It gets 'serial <serial>' and a newline and, if that is not the
+serial it sent, the index of that root in the format of the .require.index
+file, see module_manager.py. The serial changes with every change of the
+index. Roots which are not served, or not while a module in them can't be
+watched, get an empty answer, then require looks at the file system.
+"""
+
+from __future__ import print_function
+import argparse
+import ctypes
+import ctypes.util
+import errno
+import logging
+import os
+import select
+import socket
+import struct
+import sys
+import time
+
+from module_manager import INDEX_HEADER, module_entries
+
+IN_CLOSE_WRITE = 0x00000008
+IN_MOVED_FROM = 0x00000040
+IN_MOVED_TO = 0x00000080
+IN_CREATE = 0x00000100
+IN_DELETE = 0x00000200
+IN_DELETE_SELF = 0x00000400
+IN_MOVE_SELF = 0x00000800
+IN_Q_OVERFLOW = 0x00004000
+IN_IGNORED = 0x00008000
+IN_NONBLOCK = 0x00000800
+WATCH_MASK = (IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE |
+              IN_DELETE_SELF | IN_MOVE_SELF)
+EVENT = struct.Struct('iIII')
+
+class Inotify(object):
+    """Minimal inotify binding through ctypes."""
+
+    def __init__(self):
+        self._libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+        self.fd = self._libc.inotify_init1(IN_NONBLOCK)
+        if self.fd < 0:
+            raise OSError(ctypes.get_errno(), 'inotify_init1 failed')
+
+    def add_watch(self, path):
+        """Watch directory path, returns the watch descriptor or -1."""
+        return self._libc.inotify_add_watch(self.fd, path.encode(), WATCH_MASK)
+
+    def rm_watch(self, wd):
+        """Stop watching."""
+        self._libc.inotify_rm_watch(self.fd, wd)
+
+    def read(self):
+        """Return the pending events as (wd, mask, name)."""
+        events = []
+        try:
+            data = os.read(self.fd, 65536)
+        except OSError as why:
+            if why.errno == errno.EAGAIN:
+                return events
+            raise
+        offset = 0
+        while offset < len(data):
+            wd, mask, _, length = EVENT.unpack_from(data, offset)
+            offset += EVENT.size
+            name = data[offset:offset + length].rstrip(b'\0').decode()
+            offset += length
+            events.append((wd, mask, name))
+        return events
+
+class ModuleTree(object):
+    """Index of one root, rescanned per module when inotify reports changes
+    anywhere in the directories which decide what is installed.
+    """
+
+    def __init__(self, root, inotify):
+        self.root = root
+        self._inotify = inotify
+        self._entries = {}
+        self._watches = {}
+        self._dirty = set()
+        self._unwatched = set()
+        self._index = None
+        # Serials of a restarted resolver differ from those it gave before
+        self._start = int(time.time())
+        self._changes = 0
+        self._rootwd = inotify.add_watch(root)
+        if self._rootwd < 0:
+            raise OSError(ctypes.get_errno(), 'Can\'t watch {}'.format(root))
+        self._dirty.update(os.listdir(root))
+
+    def owns(self, wd):
+        """Check if the watch descriptor belongs to this root."""
+        return wd == self._rootwd or wd in self._watches
+
+    def changed(self, wd, mask, name):
+        """Record an inotify event."""
+        if mask & IN_IGNORED:
+            self._watches.pop(wd, None)
+        elif wd == self._rootwd:
+            if name:
+                self._dirty.add(name)
+        elif wd in self._watches:
+            self._dirty.add(self._watches[wd])
+        self._index = None
+        self._changes += 1
+
+    def rescan(self):
+        """Read everything again, after events were lost."""
+        self._dirty.update(self._entries)
+        self._dirty.update(os.listdir(self.root))
+        self._index = None
+        self._changes += 1
+
+    def serial(self):
+        """The serial of the current index."""
+        return '{}.{}.{}'.format(os.getpid(), self._start, self._changes)
+
+    def _scan(self, name):
+        for wd in [wd for wd, module in self._watches.items() if module == name]:
+            self._inotify.rm_watch(wd)
+            del self._watches[wd]
+        self._entries.pop(name, None)
+        self._unwatched.discard(name)
+        if name.startswith('.'):
+            return
+        moduledir = os.path.join(self.root, name)
+        # Watch first, so that nothing installed while scanning is missed
+        for path, _ in walk_dirs(moduledir, 4):
+            wd = self._inotify.add_watch(path)
+            if wd < 0:
+                # Changes would be missed, for example when max_user_watches
+                # is exhausted
+                logging.getLogger(__name__).warning('Can\'t watch {}: {}'.format(
+                    path, os.strerror(ctypes.get_errno())))
+                self._unwatched.add(name)
+                return
+            self._watches[wd] = name
+        entries = module_entries(self.root, name)
+        if entries:
+            self._entries[name] = entries
+        logging.getLogger(__name__).debug('Scanned {}: {} entries'.format(moduledir, len(entries)))
+
+    def index(self):
+        """The index of the root in the format of the .require.index file, or
+        None while a module can't be watched. Such modules are tried again
+        each time, meanwhile require looks at the file system itself.
+        """
+        if self._unwatched:
+            self._dirty.update(self._unwatched)
+            self._index = None
+        if self._index is None:
+            while self._dirty:
+                self._scan(self._dirty.pop())
+            if self._unwatched:
+                return None
+            lines = [INDEX_HEADER]
+            for name in sorted(self._entries):
+                lines.extend(' '.join(entry) for entry in sorted(self._entries[name]))
+            self._index = '\n'.join(lines) + '\n'
+        return self._index
+
+def walk_dirs(path, maxdepth, depth=0):
+    """Yield path and its subdirectories up to maxdepth levels down, with their
+    depth. These are the module, version, EPICS version, lib and architecture
+    directories, plus their siblings like db and dbd.
+    """
+    if not os.path.isdir(path) or (os.path.islink(path) and depth > 0):
+        return
+    yield path, depth
+    if depth == maxdepth:
+        return
+    try:
+        names = os.listdir(path)
+    except OSError:
+        return
+    for name in names:
+        for sub in walk_dirs(os.path.join(path, name), maxdepth, depth + 1):
+            yield sub
+
+def serve(sockpath, roots, mode=0o660):
+    """Answer index requests until killed. IOCs of other users need write
+    permission on the socket to connect, given with mode.
+    """
+    logger = logging.getLogger(__name__)
+    inotify = Inotify()
+    trees = {}
+    for root in roots:
+        tree = ModuleTree(root, inotify)
+        trees[root] = tree
+        trees[os.path.realpath(root)] = tree
+        index = tree.index()
+        if index is None:
+            logger.warning('Not serving {} while not all of it can be watched'.format(root))
+        else:
+            logger.info('Indexed {}: {} lines'.format(root, index.count('\n') - 1))
+
+    if os.path.exists(sockpath):
+        os.unlink(sockpath)
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    server.bind(sockpath)
+    os.chmod(sockpath, mode)
+    server.listen(64)
+    logger.info('Serving on {}'.format(sockpath))
+
+    while True:
+        readable, _, _ = select.select([server, inotify.fd], [], [])
+        # Events are read before each answer, so that a request sees every
+        # change made before it was sent
+        for wd, mask, name in inotify.read():
+            if mask & IN_Q_OVERFLOW:
+                for tree in set(trees.values()):
+                    tree.rescan()
+                continue
+            for tree in set(trees.values()):
+                if tree.owns(wd):
+                    tree.changed(wd, mask, name)
+        if server in readable:
+            conn, _ = server.accept()
+            try:
+                conn.settimeout(2)
+                request = b''
+                while not request.endswith(b'\n'):
+                    data = conn.recv(4096)
+                    if not data:
+                        break
+                    request += data
+                root, _, serial = request.decode().strip().rpartition(' ')
+                tree = trees.get(root) or trees.get(os.path.realpath(root))
+                index = tree.index() if tree else None
+                if index is None:
+                    tree = None
+                else:
+                    answer = 'serial {}\n'.format(tree.serial())
+                    if serial != tree.serial():
+                        answer += index
+                    conn.sendall(answer.encode())
+                logger.debug('Request for {}{}'.format(root, '' if tree else ', not served'))
+            except (socket.error, socket.timeout) as why:
+                logger.warning('Request failed: {}'.format(why))
+            finally:
+                conn.close()
+
+def main():
+    """Main function"""
+    parser = argparse.ArgumentParser(description='Serve the module index of EPICS_MODULES_PATH to require.')
+    parser.add_argument('roots', nargs='*', metavar='ROOT',
+                        help='Module roots to serve (default the roots in EPICS_MODULES_PATH).')
+    parser.add_argument('--socket', metavar='PATH', default=os.environ.get('REQUIRE_RESOLVER'),
+                        help='Unix socket to serve on (default $REQUIRE_RESOLVER), '
+                        'put it in a directory only the owner of the module tree can write to.')
+    parser.add_argument('--mode', metavar='MODE', type=lambda mode: int(mode, 8), default=0o660,
+                        help='Permissions of the socket (default 660).')
+    parser.add_argument('--daemon', action='store_true', help='Detach from the terminal.')
+    parser.add_argument('--debug', action='store_true')
+    args = parser.parse_args()
+
+    if args.debug:
+        logging.getLogger(__name__).setLevel(logging.DEBUG)
+    else:
+        logging.getLogger(__name__).setLevel(logging.INFO)
+
+    roots = args.roots or [root for root in os.environ.get('EPICS_MODULES_PATH', '').split(os.pathsep) if root]
+    if not roots:
+        parser.error('no module roots given and EPICS_MODULES_PATH is not set')
+    if not args.socket:
+        parser.error('no --socket given and REQUIRE_RESOLVER is not set')
+
+    if args.daemon and os.fork() > 0:
+        return 0
+    if args.daemon:
+        os.setsid()
+        devnull = os.open(os.devnull, os.O_RDWR)
+        for fd in (0, 1, 2):
+            os.dup2(devnull, fd)
+    serve(args.socket, roots, args.mode)
+    return 0
+
+if __name__ == '__main__':
+    logging.basicConfig(format='%(filename)s: %(message)s')
+    sys.exit(main())
@@ -29,17 +29,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include <iocsh.h>
 #include <dbAccess.h>
+#include <dbStaticLib.h>
+#include <dbLoadTemplate.h>
 epicsShareFunc int epicsShareAPI iocshCmd (const char *cmd);
 #include <epicsExit.h>
 #include <epicsExport.h>
 #include <envDefs.h>
+#include <macLib.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+#include <initHooks.h>
 
 #include "require.h"
 
+/* Base 7 shell commands report failures with iocshSetError() */
+#if defined (VERSION_INT) && EPICS_VERSION_INT >= VERSION_INT(7,0,5,0)
+#define iocsh_set_error(status) iocshSetError(status)
+#else
+#define iocsh_set_error(status) ((void)(status))
+#endif
+
 int requireDebug = 0;
+int requirePipeline = 0;
+int requireDbdCache = 1;
 
 #define debug_print(fmt, ...) \
         do { if (requireDebug) printf("require: " fmt, __VA_ARGS__); } while (0)
@@ -55,6 +73,8 @@ static int firstTime = 1;
 #define LIBNAMEPOST "LibRelease"
 #define LOC_MODULES "modules"
 #define BUILDDIR "builddir"
+#define INDEXFILE ".require.index"
+#define INDEXHEADER "# require module index 1\n"
 #define MIN(a,b) (a) < (b) ? (a) : (b)
 
 #if defined (vxWorks)
@@ -85,6 +105,12 @@ static int firstTime = 1;
     #include <fcntl.h>
     #include <dirent.h>
     #include <dlfcn.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/time.h>
+    #include <time.h>
+    #include <errno.h>
     #define HMODULE void *
 
     #define getAddress(module,name) (dlsym(module, name))
@@ -119,6 +145,33 @@ static int firstTime = 1;
 
 #endif
 
+/*
+ * How module libraries are loaded, set with REQUIRE_LOAD_POLICY:
+ *   now      - resolve all symbols when a library is loaded (default)
+ *   lazy     - resolve functions when they are called first
+ *   deferred - lazy, and load libraries only when they are needed:
+ *              a library without dbd file when a module depending on it is
+ *              loaded, or after iocInit, unless it registers something
+ *              itself; a library with nothing but device support at
+ *              iocInit, and only if records use its device support.
+ */
+enum { LOAD_NOW, LOAD_LAZY, LOAD_DEFERRED };
+
+static const char *loadPolicyNames[] = { "now", "lazy", "deferred" };
+
+static int load_policy(void)
+{
+        const char *policy = getenv("REQUIRE_LOAD_POLICY");
+        int i;
+
+        if (policy) {
+                for (i = 0; i < (int)(sizeof(loadPolicyNames)/sizeof(loadPolicyNames[0])); i++) {
+                        if (strcmp(policy, loadPolicyNames[i]) == 0) return i;
+                }
+        }
+        return LOAD_NOW;
+}
+
 /* loadlib (library)
 Find a loadable library by name and load it.
 */
@@ -134,7 +187,7 @@ static HMODULE loadlib(const char* libname)
     }
 
 #if defined (__unix__)
-    if (!(libhandle = dlopen(libname, RTLD_NOW|RTLD_GLOBAL)))
+    if (!(libhandle = dlopen(libname, (load_policy() == LOAD_NOW ? RTLD_NOW : RTLD_LAZY)|RTLD_GLOBAL)))
     {
         fprintf (stderr, "Loading %s library failed: %s.\n",
             libname, dlerror());
@@ -184,45 +237,575 @@ static HMODULE loadlib(const char* libname)
     return libhandle;
 }
 
-struct module_list
-{
-    struct module_list *next;
-    char name[100];   /* Module name */
-    char version[20]; /* MAJOR.MINOR.PATCH[+], USER or COMMIT_REVISION */
-};
-
 struct module_version {
         int major;
         int minor;
         int patch;
-        int exact; /* 0 - higher versions also validate against this. */
 };
 
-struct module_list *loadedModules = NULL;
+/*
+ * Strings which live as long as the process, like module names and
+ * versions, are interned: every distinct string is stored only once.
+ */
+#define STRINGPOOL_CHUNK 4096
+
+static struct {
+        const char **slots;  /* Open addressing hash set */
+        unsigned int size;   /* Number of slots, power of 2 */
+        unsigned int count;
+        char *chunk;         /* Storage for new strings */
+        size_t left;         /* Free bytes in chunk */
+} stringPool;
+
+/* FNV-1a */
+static unsigned int hash_string(const char *s)
+{
+        unsigned int h = 2166136261u;
+        while (*s) {
+                h ^= (unsigned char)*s++;
+                h *= 16777619u;
+        }
+        return h;
+}
+
+static const char *intern(const char *s)
+{
+        unsigned int i;
+        size_t len;
+        char *p;
+
+        if (stringPool.count * 2 >= stringPool.size) {
+                unsigned int size = stringPool.size ? stringPool.size * 2 : 64;
+                const char **slots = calloc(size, sizeof(const char *));
+                if (!slots) {
+                        fprintf(stderr, "require: out of memory.\n");
+                        return NULL;
+                }
+                for (i = 0; i < stringPool.size; i++) {
+                        unsigned int j;
+                        if (!stringPool.slots[i]) continue;
+                        for (j = hash_string(stringPool.slots[i]) & (size - 1); slots[j]; j = (j + 1) & (size - 1));
+                        slots[j] = stringPool.slots[i];
+                }
+                free(stringPool.slots);
+                stringPool.slots = slots;
+                stringPool.size = size;
+        }
+        for (i = hash_string(s) & (stringPool.size - 1); stringPool.slots[i]; i = (i + 1) & (stringPool.size - 1)) {
+                if (strcmp(stringPool.slots[i], s) == 0) {
+                        return stringPool.slots[i];
+                }
+        }
+        len = strlen(s) + 1;
+        if (len > stringPool.left) {
+                size_t size = len > STRINGPOOL_CHUNK ? len : STRINGPOOL_CHUNK;
+                if (!(stringPool.chunk = malloc(size))) {
+                        stringPool.left = 0;
+                        fprintf(stderr, "require: out of memory.\n");
+                        return NULL;
+                }
+                stringPool.left = size;
+        }
+        p = stringPool.chunk;
+        memcpy(p, s, len);
+        stringPool.chunk += len;
+        stringPool.left -= len;
+        stringPool.slots[i] = p;
+        stringPool.count++;
+        return p;
+}
+
+/*
+ * Phases of loading a module which are timed for requireStats.
+ */
+enum {
+        PHASE_RESOLVE,   /* Finding the version to load */
+        PHASE_DEPS,      /* Parsing dependencies, without resolving them */
+        PHASE_LIB,       /* Loading the library */
+        PHASE_DBD,       /* Loading the dbd file */
+        PHASE_REGISTER,  /* Calling the register function */
+        PHASES
+};
+
+static const char *phaseNames[PHASES] = { "resolve", "deps", "lib", "dbd", "register" };
 
 /*
- * Add module first in loadedModules list.
+ * Seconds since an arbitrary start, not affected by changes of the system
+ * time where the OS provides a monotonic clock.
  */
-static void registerModule(const char* module, const char* version)
+static double monotonic(void)
 {
-        struct module_list* m = (struct module_list*) calloc(sizeof (struct module_list),1);
-        if (!m) {
-                fprintf (stderr, "require: out of memory.\n");
+#if defined (__unix__)
+        struct timespec ts;
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+                return ts.tv_sec + ts.tv_nsec * 1e-9;
         }
-        else {
-                strncat (m->name, module, sizeof(m->name) - 1);
-                strncat (m->version, version, sizeof(m->version) - 1);
-                m->next = loadedModules;
-                loadedModules = m;
-                int env_var_size = strlen(m->name) + sizeof("REQUIRE__VERSION");
-                char *env_var = malloc(env_var_size * sizeof (char));
-                if(!env_var) {
-                        fprintf(stderr, "Out of memory\n");
-                        return;
+#endif
+        {
+                epicsTimeStamp now;
+                epicsTimeGetCurrent(&now);
+                return now.secPastEpoch + now.nsec * 1e-9;
+        }
+}
+
+/*
+ * Trace of the IOC startup. When enabled, calls to require and friends are
+ * recorded as begin and end events and written in the Chrome trace event
+ * format, which trace viewers show as a flame chart per thread.
+ */
+struct trace_event {
+        char phase;         /* 'B' begin or 'E' end */
+        char *name;         /* NULL for end events */
+        double ts;          /* Seconds since trace.start */
+        unsigned long tid;
+};
+
+static struct {
+        int enabled;
+        epicsMutexId lock;
+        struct trace_event *events;
+        int count;
+        int size;
+        double start;
+        char *file;         /* Written at iocInit */
+} trace;
+
+static void *grow(void *array, int *size, int count, size_t elemsize);
+
+static void trace_event(char phase, const char *name, const char *detail)
+{
+        struct trace_event *events;
+        struct trace_event *e;
+        double now = monotonic();
+
+        epicsMutexMustLock(trace.lock);
+        if (!(events = grow(trace.events, &trace.size, trace.count, sizeof(struct trace_event)))) {
+                epicsMutexUnlock(trace.lock);
+                return;
+        }
+        trace.events = events;
+        e = &trace.events[trace.count++];
+        e->phase = phase;
+        e->name = NULL;
+        if (name && (e->name = malloc(strlen(name) + (detail ? strlen(detail) : 0) + 2))) {
+                sprintf(e->name, "%s%s%s", name, detail ? " " : "", detail ? detail : "");
+        }
+        e->ts = now - trace.start;
+        e->tid = (unsigned long)epicsThreadGetIdSelf();
+        epicsMutexUnlock(trace.lock);
+}
+
+#define trace_begin(name, detail) \
+        do { if (trace.enabled) trace_event('B', name, detail); } while (0)
+#define trace_end() \
+        do { if (trace.enabled) trace_event('E', NULL, NULL); } while (0)
+
+static void trace_init_hook(initHookState state)
+{
+        if (state == initHookAfterIocRunning && trace.file) {
+                requireTraceWrite(NULL);
+        }
+}
+
+/*
+ * Start recording a trace. If filename is given, the trace is written to it
+ * when the IOC is running.
+ */
+int requireTrace(const char *filename)
+{
+        if (!trace.lock && !(trace.lock = epicsMutexCreate())) {
+                fprintf(stderr, "require: Can't create trace lock.\n");
+                return -1;
+        }
+        if (filename && filename[0]) {
+                free(trace.file);
+                trace.file = strdup(filename);
+        }
+        if (!trace.enabled) {
+                static int hooked = 0;
+                if (!hooked) {
+                        hooked = 1;
+                        initHookRegister(trace_init_hook);
+                }
+                trace.start = monotonic();
+                trace.enabled = 1;
+        }
+        return 0;
+}
+
+static void trace_print_string(FILE *file, const char *s)
+{
+        fputc('"', file);
+        for (; *s; s++) {
+                if (*s == '"' || *s == '\\') {
+                        fprintf(file, "\\%c", *s);
+                } else if ((unsigned char)*s < 0x20) {
+                        fprintf(file, "\\u%04x", *s);
+                } else {
+                        fputc(*s, file);
+                }
+        }
+        fputc('"', file);
+}
+
+/*
+ * Write the events recorded so far as Chrome trace event JSON to filename,
+ * or to the file given to requireTrace.
+ */
+int requireTraceWrite(const char *filename)
+{
+        FILE *file;
+        int pid = 1;
+        int i;
+
+        if (!filename || !filename[0]) {
+                filename = trace.file;
+        }
+        if (!filename) {
+                printf("Usage: requireTraceWrite \"<tracefile>\".\n");
+                return -1;
+        }
+        if (!trace.lock) {
+                fprintf(stderr, "require: No trace recorded, call requireTrace first.\n");
+                return -1;
+        }
+        if (!(file = fopen(filename, "w"))) {
+                fprintf(stderr, "require: Can't open %s for writing.\n", filename);
+                return -1;
+        }
+#if defined (__unix__)
+        pid = getpid();
+#endif
+        epicsMutexMustLock(trace.lock);
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+        for (i = 0; i < trace.count; i++) {
+                struct trace_event *e = &trace.events[i];
+                fprintf(file, "%s\n{\"ph\":\"%c\",\"cat\":\"require\",\"pid\":%d,\"tid\":%lu,\"ts\":%.3f",
+                        i ? "," : "", e->phase, pid, e->tid, e->ts * 1e6);
+                if (e->name) {
+                        fprintf(file, ",\"name\":");
+                        trace_print_string(file, e->name);
+                }
+                fputc('}', file);
+        }
+        fprintf(file, "\n]}\n");
+        epicsMutexUnlock(trace.lock);
+        fclose(file);
+        printf("require: Wrote %d trace events to %s.\n", i, filename);
+        return 0;
+}
+
+/*
+ * Boot profile. The files require reads during the boot (dependency files,
+ * libraries, dbd files and the files given to the record loading calls) are
+ * recorded in the order they are first read and written to the profile file
+ * when the IOC is running. When a profile exists, a thread asks the kernel to
+ * read all its files ahead right away, so that after a reboot the page cache
+ * is filled while the startup script is still at its beginning.
+ */
+#define PROFILEHEADER "# require profile 1\n"
+
+static struct {
+        int enabled;
+        const char **files;  /* Interned, in the order of first use */
+        int count;
+        int size;
+        char *file;
+} profile;
+
+static void profile_add(const char *filename)
+{
+        const char **files;
+        int i;
+
+        if (!profile.enabled || !filename || !(filename = intern(filename))) {
+                return;
+        }
+        for (i = 0; i < profile.count; i++) {
+                if (profile.files[i] == filename) return;
+        }
+        if (!(files = grow(profile.files, &profile.size, profile.count, sizeof(const char *)))) {
+                return;
+        }
+        profile.files = files;
+        profile.files[profile.count++] = filename;
+}
+
+static void profile_write(void)
+{
+        char tmpname[512];
+        FILE *file;
+        int i;
+
+        snprintf(tmpname, sizeof(tmpname), "%s.tmp", profile.file);
+        if (!(file = fopen(tmpname, "w"))) {
+                fprintf(stderr, "require: Can't write profile %s: %s\n", tmpname, strerror(errno));
+                return;
+        }
+        fputs(PROFILEHEADER, file);
+        for (i = 0; i < profile.count; i++) {
+                fprintf(file, "%s\n", profile.files[i]);
+        }
+        if (fclose(file) != 0 || rename(tmpname, profile.file) != 0) {
+                fprintf(stderr, "require: Can't write profile %s: %s\n", profile.file, strerror(errno));
+                remove(tmpname);
+                return;
+        }
+        debug_print("Wrote profile of %d files to %s.\n", profile.count, profile.file);
+}
+
+static void profile_init_hook(initHookState state)
+{
+        /* Only a boot which got this far is worth repeating */
+        if (state == initHookAfterIocRunning && profile.enabled) {
+                profile_write();
+                profile.enabled = 0;
+        }
+}
+
+#if defined (__unix__)
+static void prefetch_worker(void *arg)
+{
+        char *list = arg;
+        char *p, *end;
+        int n = 0;
+        double start = monotonic();
+
+        for (p = list; *p; p = end) {
+                int fd;
+                if ((end = strchr(p, '\n'))) *end++ = '\0'; else end = p + strlen(p);
+                if (*p == '#' || (fd = open(p, O_RDONLY)) < 0) continue;
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+                n++;
+        }
+        debug_print("Prefetched %d files in %.3f ms.\n", n, (monotonic() - start) * 1000);
+        free(list);
+}
+
+/*
+ * Start reading the files of the profile in the background.
+ */
+static void profile_prefetch(const char *filename)
+{
+        struct stat filestat;
+        FILE *file;
+        char *list;
+        size_t size;
+
+        if (!(file = fopen(filename, "r"))) {
+                debug_print("No profile %s yet.\n", filename);
+                return;
+        }
+        if (fstat(fileno(file), &filestat) != 0 || !(list = malloc(filestat.st_size + 1))) {
+                fclose(file);
+                return;
+        }
+        size = fread(list, 1, filestat.st_size, file);
+        fclose(file);
+        list[size] = '\0';
+        if (strncmp(list, PROFILEHEADER, sizeof(PROFILEHEADER) - 1) != 0) {
+                fprintf(stderr, "require: %s is not a require profile.\n", filename);
+                free(list);
+                return;
+        }
+        if (!epicsThreadCreate("requirePrefetch", epicsThreadPriorityLow,
+                epicsThreadGetStackSize(epicsThreadStackSmall), prefetch_worker, list)) {
+                free(list);
+        }
+}
+#else
+static void profile_prefetch(const char *filename)
+{
+}
+#endif
+
+/* Wrap dbLoadRecords and dbLoadTemplate to see the files they read */
+static void load_commands_wrap(void);
+
+/*
+ * Prefetch the files of the profile and record a new one, written when the
+ * IOC is running.
+ */
+int requireProfile(const char *filename)
+{
+        static int hooked = 0;
+
+        if (!filename || !filename[0]) {
+                printf("Usage: requireProfile \"<profilefile>\".\n");
+                return -1;
+        }
+        free(profile.file);
+        if (!(profile.file = strdup(filename))) {
+                fprintf(stderr, "require: out of memory.\n");
+                return -1;
+        }
+        profile_prefetch(filename);
+        if (!hooked) {
+                hooked = 1;
+                initHookRegister(profile_init_hook);
+        }
+        profile.count = 0;
+        profile.enabled = 1;
+        load_commands_wrap();
+        return 0;
+}
+
+/*
+ * A loaded module. Entries are never moved or freed.
+ */
+struct module_entry
+{
+        const char *name;     /* Module name, interned */
+        const char *version;  /* MAJOR.MINOR.PATCH[+], USER or COMMIT_REVISION, interned */
+        unsigned int hash;    /* hash_string(name) */
+        char path[256];       /* Module path or system library, empty for external modules */
+        int contents;         /* Parts found when loading, see CONTENTS_* */
+        char *deps;           /* Dependencies, "module[,version]" separated by spaces */
+        double times[PHASES]; /* Seconds spent in each phase */
+        double later[PHASES]; /* Seconds spent after the boot on a deferred library */
+        HMODULE handle;       /* Library handle, NULL if no library is loaded */
+        int deferred;         /* Library not loaded yet, see DEFER_* */
+        char *devices;        /* Device support of a DEFER_DEVICE library */
+};
+
+#define DEFER_LIB      1  /* Library without dbd file */
+#define DEFER_DEVICE   2  /* Library with only device support */
+#define DEFER_UNUSED   3  /* Device support not used by any record */
+
+/*
+ * Publish a pointer or count to readers which take no lock. A reader which
+ * sees the new value with read_ptr() or read_int() also sees everything
+ * written before it was published.
+ */
+#if EPICS_VERSION > 3 || (EPICS_VERSION == 3 && EPICS_REVISION >= 15)
+#include <epicsAtomic.h>
+#define publish_ptr(var, value) epicsAtomicSetPtrT((EpicsAtomicPtrT *)&(var), (value))
+#define read_ptr(var) epicsAtomicGetPtrT((const EpicsAtomicPtrT *)&(var))
+#define publish_int(var, value) epicsAtomicSetIntT(&(var), (value))
+#define read_int(var) epicsAtomicGetIntT(&(var))
+#else
+#define publish_ptr(var, value) do { __sync_synchronize(); (var) = (value); } while (0)
+#define read_ptr(var) __extension__ ({ void *v = (void *)(var); __sync_synchronize(); v; })
+#define publish_int(var, value) do { __sync_synchronize(); (var) = (value); } while (0)
+#define read_int(var) __extension__ ({ int v = (var); __sync_synchronize(); v; })
+#endif
+
+struct module_slots {
+        unsigned int size;             /* Number of slots, power of 2 */
+        struct module_entry *slot[1];  /* Actually size slots */
+};
+
+/*
+ * Registry of loaded modules, in load order and indexed by an open
+ * addressing hash table on the module name. Lookups take no lock, so that
+ * getLibVersion() never waits for a require running in another thread:
+ * name, version and path of an entry are set before it is published, and
+ * the arrays are replaced by larger copies instead of being changed in place
+ * when they are full. Replaced arrays are never freed, a reader may still use
+ * them. The other fields of an entry are filled in while the module loads and
+ * are only read with registryLock held. Threads changing the registry, or
+ * anything else require keeps, like the search paths, hold registryLock, see
+ * registry_lock().
+ */
+static struct {
+        struct module_slots *slots;    /* Hash table */
+        struct module_entry **modules; /* In load order */
+        int count;
+        int modulessize;
+} loadedModules;
+
+static epicsMutexId registryLock;
+
+static struct module_entry *findModule(const char* module)
+{
+        struct module_slots *slots = read_ptr(loadedModules.slots);
+        unsigned int h, i;
+        struct module_entry *m;
+
+        if (!slots || !module) return NULL;
+        h = hash_string(module);
+        for (i = h & (slots->size - 1); (m = read_ptr(slots->slot[i])); i = (i + 1) & (slots->size - 1))
+        {
+                if (m->hash == h && strcmp(m->name, module) == 0)
+                {
+                        return m;
+                }
+        }
+        return NULL;
+}
+
+/*
+ * The loaded modules in load order, without taking a lock. Modules
+ * registered meanwhile are not in the list.
+ */
+static struct module_entry **module_list(int *count)
+{
+        *count = read_int(loadedModules.count);
+        return read_ptr(loadedModules.modules);
+}
+
+/*
+ * Add module to loadedModules. The caller holds registryLock.
+ */
+static struct module_entry *registerModule(const char* module, const char* version, const char* path)
+{
+        struct module_slots *slots = loadedModules.slots;
+        struct module_entry* m;
+        unsigned int i;
+
+        if (!slots || loadedModules.count * 2 >= (int)slots->size) {
+                unsigned int size = slots ? slots->size * 2 : 256;
+                struct module_slots *bigger = calloc(1, sizeof(struct module_slots) + (size - 1) * sizeof(struct module_entry *));
+                if (!bigger) {
+                        fprintf (stderr, "require: out of memory.\n");
+                        return NULL;
                 }
-                snprintf(env_var, env_var_size, "REQUIRE_%s_VERSION", m->name);
-                epicsEnvSet(env_var, version);
+                bigger->size = size;
+                for (i = 0; i < (unsigned int)loadedModules.count; i++) {
+                        unsigned int j;
+                        for (j = loadedModules.modules[i]->hash & (size - 1); bigger->slot[j]; j = (j + 1) & (size - 1));
+                        bigger->slot[j] = loadedModules.modules[i];
+                }
+                publish_ptr(loadedModules.slots, bigger);
+                slots = bigger;
+        }
+        if (loadedModules.count >= loadedModules.modulessize) {
+                int size = loadedModules.modulessize ? loadedModules.modulessize * 2 : 64;
+                struct module_entry **modules = malloc(size * sizeof(struct module_entry *));
+                if (!modules) {
+                        fprintf (stderr, "require: out of memory.\n");
+                        return NULL;
+                }
+                if (loadedModules.count) {
+                        memcpy(modules, loadedModules.modules, loadedModules.count * sizeof(struct module_entry *));
+                }
+                publish_ptr(loadedModules.modules, modules);
+                loadedModules.modulessize = size;
+        }
+        m = (struct module_entry*) calloc(sizeof (struct module_entry),1);
+        if (!m || !(m->name = intern(module)) || !(m->version = intern(version))) {
+                fprintf (stderr, "require: out of memory.\n");
+                free(m);
+                return NULL;
+        }
+        m->hash = hash_string(module);
+        if (path) snprintf(m->path, sizeof(m->path), "%s", path);
+        for (i = m->hash & (slots->size - 1); slots->slot[i]; i = (i + 1) & (slots->size - 1));
+        publish_ptr(slots->slot[i], m);
+        loadedModules.modules[loadedModules.count] = m;
+        publish_int(loadedModules.count, loadedModules.count + 1);
+
+        int env_var_size = strlen(m->name) + sizeof("REQUIRE__VERSION");
+        char *env_var = malloc(env_var_size * sizeof (char));
+        if(!env_var) {
+                fprintf(stderr, "Out of memory\n");
+                return m;
         }
+        snprintf(env_var, env_var_size, "REQUIRE_%s_VERSION", m->name);
+        epicsEnvSet(env_var, version);
+        free(env_var);
+        return m;
 }
 
 #if defined (vxWorks)
@@ -243,7 +826,7 @@ BOOL findLibRelease (
     libname[e-1]=0;
     if (!getLibVersion(libname))
     {
-        registerModule(libname, (char*)val);
+        registerModule(libname, (char*)val, NULL);
     }
     return TRUE;
 }
@@ -257,32 +840,139 @@ static void registerExternalModules()
 
 #include <link.h>
 
+/*
+ * The dynamic section is relocated by the loader on most targets,
+ * but not for example in the vdso.
+ */
+#define DYNADDR(info,ptr) ((ptr) < (info)->dlpi_addr ? (info)->dlpi_addr + (ptr) : (ptr))
+
+/*
+ * Find a defined symbol in the dynamic symbol table of a loaded object,
+ * using its GNU or SysV hash table. This reads only what the loader
+ * has already mapped.
+ */
+static void* findDynamicSymbol(struct dl_phdr_info *info, const char* name)
+{
+    const ElfW(Dyn)* dyn = NULL;
+    const ElfW(Sym)* symtab = NULL;
+    const char* strtab = NULL;
+    const Elf32_Word* gnuhash = NULL;
+    const Elf32_Word* sysvhash = NULL;
+    const ElfW(Sym)* sym;
+    const unsigned char* c;
+    uint32_t h, i;
+    int j;
+
+    for (j = 0; j < info->dlpi_phnum; j++)
+    {
+        if (info->dlpi_phdr[j].p_type == PT_DYNAMIC)
+        {
+            dyn = (const ElfW(Dyn)*)(info->dlpi_addr + info->dlpi_phdr[j].p_vaddr);
+            break;
+        }
+    }
+    if (!dyn) return NULL;
+    for (; dyn->d_tag != DT_NULL; dyn++)
+    {
+        switch (dyn->d_tag)
+        {
+            case DT_SYMTAB:
+                symtab = (const ElfW(Sym)*)DYNADDR(info, dyn->d_un.d_ptr);
+                break;
+            case DT_STRTAB:
+                strtab = (const char*)DYNADDR(info, dyn->d_un.d_ptr);
+                break;
+            case DT_GNU_HASH:
+                gnuhash = (const Elf32_Word*)DYNADDR(info, dyn->d_un.d_ptr);
+                break;
+            case DT_HASH:
+                sysvhash = (const Elf32_Word*)DYNADDR(info, dyn->d_un.d_ptr);
+                break;
+        }
+    }
+    if (!symtab || !strtab) return NULL;
+
+    if (gnuhash)
+    {
+        /* nbuckets, symoffset, bloom size, bloom shift, bloom, buckets, chains */
+        const uint32_t nbuckets = gnuhash[0];
+        const uint32_t symoffset = gnuhash[1];
+        const uint32_t bloomsize = gnuhash[2];
+        const uint32_t bloomshift = gnuhash[3];
+        const ElfW(Addr)* bloom = (const ElfW(Addr)*)&gnuhash[4];
+        const uint32_t* buckets = (const uint32_t*)&bloom[bloomsize];
+        const uint32_t* chain = &buckets[nbuckets];
+        const unsigned bits = sizeof(ElfW(Addr)) * 8;
+        ElfW(Addr) word;
+
+        if (nbuckets == 0 || bloomsize == 0) return NULL;
+        for (h = 5381, c = (const unsigned char*)name; *c; c++) h = h * 33 + *c;
+        word = bloom[(h / bits) % bloomsize];
+        if (!((word >> (h % bits)) & (word >> ((h >> bloomshift) % bits)) & 1)) return NULL;
+        i = buckets[h % nbuckets];
+        if (i < symoffset) return NULL;
+        for (;; i++)
+        {
+            uint32_t h2 = chain[i - symoffset];
+            sym = &symtab[i];
+            if ((h | 1) == (h2 | 1) && sym->st_shndx != SHN_UNDEF &&
+                strcmp(name, strtab + sym->st_name) == 0)
+                return (void*)(info->dlpi_addr + sym->st_value);
+            if (h2 & 1) break;
+        }
+        return NULL;
+    }
+
+    if (sysvhash)
+    {
+        /* nbucket, nchain, buckets, chains */
+        const Elf32_Word nbucket = sysvhash[0];
+        const Elf32_Word* chain = &sysvhash[2 + nbucket];
+
+        if (nbucket == 0) return NULL;
+        for (h = 0, c = (const unsigned char*)name; *c; c++)
+        {
+            uint32_t g;
+            h = (h << 4) + *c;
+            if ((g = h & 0xf0000000)) h ^= g >> 24;
+            h &= ~g;
+        }
+        for (i = sysvhash[2 + h % nbucket]; i != STN_UNDEF; i = chain[i])
+        {
+            sym = &symtab[i];
+            if (sym->st_shndx != SHN_UNDEF && strcmp(name, strtab + sym->st_name) == 0)
+                return (void*)(info->dlpi_addr + sym->st_value);
+        }
+    }
+    return NULL;
+}
+
 int findLibRelease (
     struct dl_phdr_info *info, /* shared library info */
     size_t size,               /* size of info structure */
     void *data                 /* user-supplied arg */
 ) {
-    void *handle;
-    char symname [80];
+    char symname [sizeof(LIBNAMEPRE) + NAME_MAX + sizeof(LIBNAMEPOST)];
     const char* p;
-    char* q;
+    char* name;
+    size_t len;
     char* version;
 
-    //printf("libname: %s\n", info->dlpi_name);
-
+    /* Modules are in lib<name>.so or lib<name>-<version>.so */
     if (!info->dlpi_name || !info->dlpi_name[0]) return 0;
     p = strrchr(info->dlpi_name, '/');
-    if (p) p+=4; else p=info->dlpi_name + 3;
-    symname[0] = '_';
-    for (q=symname+1; *p && *p != '.' && *p != '-' && q < symname+11; p++, q++) *q=*p;
-    strcpy(q, LIBNAMEPOST);
-    handle = dlopen(info->dlpi_name, RTLD_NOW|RTLD_GLOBAL);
-    version = dlsym(handle, symname);
-    dlclose(handle);
-    *q = 0;
-    if (version)
+    p = p ? p + 1 : info->dlpi_name;
+    if (strncmp(p, "lib", 3) != 0) return 0;
+    p += 3;
+    len = strcspn(p, ".-");
+    if (len == 0 || len > NAME_MAX) return 0;
+    name = symname + strlen(LIBNAMEPRE);
+    sprintf(symname, LIBNAMEPRE "%.*s" LIBNAMEPOST, (int)len, p);
+    if ((version = findDynamicSymbol(info, symname)))
     {
-        registerModule(symname+strlen(LIBNAMEPRE), version);
+        name[len] = 0;
+        if (!findModule(name))
+            registerModule(name, version, NULL);
     }
     return 0;
 }
@@ -307,33 +997,161 @@ static void registerExternalModules()
 }
 #endif
 
+static epicsThreadOnceId registryOnce = EPICS_THREAD_ONCE_INIT;
 
-const char* getLibVersion(const char* libname)
+static void registry_once(void *arg)
 {
-    struct module_list* m;
+    registryLock = epicsMutexMustCreate();
+    epicsMutexMustLock(registryLock);
+    registerExternalModules();
+    epicsMutexUnlock(registryLock);
+}
 
-    for (m = loadedModules; m; m=m->next)
-    {
-        if (strncmp(m->name, libname, sizeof(m->name)) == 0)
-        {
-            return m->version;
-        }
-    }
-    return NULL;
+/*
+ * Serialize threads changing what require keeps. The lock is recursive.
+ * The first call also registers the modules linked into the application.
+ */
+static void registry_lock(void)
+{
+    epicsThreadOnce(&registryOnce, registry_once, NULL);
+    epicsMutexMustLock(registryLock);
 }
 
-int libversionShow(const char* pattern)
+static void registry_unlock(void)
 {
-    struct module_list* m;
+    epicsMutexUnlock(registryLock);
+}
 
-    if (firstTime)
-    {
-        firstTime=0;
-        registerExternalModules();
-    }
+const char* getLibVersion(const char* libname)
+{
+    struct module_entry* m = findModule(libname);
+    return m ? m->version : NULL;
+}
 
-    for (m = loadedModules; m; m=m->next)
-    {
+const char* getLibLocation(const char* libname)
+{
+    struct module_entry* m = findModule(libname);
+    return m && m->path[0] ? m->path : NULL;
+}
+
+static int stats_compare(const void *a, const void *b)
+{
+    double ta = 0, tb = 0;
+    int i;
+
+    for (i = 0; i < PHASES; i++)
+    {
+        ta += (*(struct module_entry * const *)a)->times[i];
+        tb += (*(struct module_entry * const *)b)->times[i];
+    }
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+/*
+ * Print the time spent on each module loaded by require during the boot,
+ * most expensive first. The time spent on dependencies is counted for the
+ * dependencies. The time the load policy moved out of the boot is shown
+ * separately.
+ */
+int requireStats(const char* pattern)
+{
+    struct module_entry** modules;
+    struct module_entry** loaded;
+    struct module_entry* m;
+    double total, sum[PHASES] = {0}, later[PHASES] = {0};
+    int count, n = 0, nlater = 0, nunused = 0, nlibs = 0;
+    int i, j;
+
+    /* Times, contents and handle are filled in while a module loads */
+    registry_lock();
+    loaded = module_list(&count);
+    if (!(modules = calloc(count + 1, sizeof(struct module_entry*))))
+    {
+        registry_unlock();
+        fprintf(stderr, "require: out of memory.\n");
+        return -1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        m = loaded[i];
+        /* External modules are linked into the application */
+        if (m->path[0] == '\0') continue;
+        if (pattern && !strstr(m->name, pattern)) continue;
+        modules[n++] = m;
+    }
+    qsort(modules, n, sizeof(struct module_entry*), stats_compare);
+
+    printf("%20s %-12s %9s", "module", "version", "total");
+    for (j = 0; j < PHASES; j++) printf(" %9s", phaseNames[j]);
+    printf("  [ms]\n");
+    for (i = 0; i < n; i++)
+    {
+        m = modules[i];
+        for (total = 0, j = 0; j < PHASES; j++)
+        {
+            total += m->times[j];
+            sum[j] += m->times[j];
+        }
+        printf("%20s %-12s %9.2f", m->name, m->version, total * 1000);
+        for (j = 0; j < PHASES; j++) printf(" %9.2f", m->times[j] * 1000);
+        for (total = 0, j = 0; j < PHASES; j++)
+        {
+            total += m->later[j];
+            later[j] += m->later[j];
+        }
+        if (m->handle) nlibs++;
+        if (m->deferred == DEFER_UNUSED)
+        {
+            printf("  (not loaded)");
+            nunused++;
+        }
+        else if (total > 0)
+        {
+            printf("  (loaded after iocInit)");
+            nlater++;
+        }
+        else if (m->deferred) printf("  (deferred)");
+        printf("\n");
+    }
+    for (total = 0, j = 0; j < PHASES; j++) total += sum[j];
+    printf("%20s %-12s %9.2f", "all", "", total * 1000);
+    for (j = 0; j < PHASES; j++) printf(" %9.2f", sum[j] * 1000);
+    printf("\n");
+    printf("load policy: %s\n", loadPolicyNames[load_policy()]);
+    if (nlater || nunused)
+    {
+        printf("skipped at boot:\n");
+        for (total = 0, j = 0; j < PHASES; j++) total += later[j];
+        printf("%20s %-12s %9.2f", "after iocInit", "", total * 1000);
+        for (j = 0; j < PHASES; j++) printf(" %9.2f", later[j] * 1000);
+        printf("  (%d libraries)\n", nlater);
+        printf("%20s %-12s %9s", "not loaded", "", "-");
+        for (j = 0; j < PHASES; j++) printf(" %9s", "-");
+        printf("  (%d libraries)\n", nunused);
+    }
+    if (load_policy() != LOAD_NOW && nlibs)
+    {
+        printf("functions of %d libraries are bound on their first call, that time is not measured\n", nlibs);
+    }
+    registry_unlock();
+    free(modules);
+    return 0;
+}
+
+int libversionShow(const char* pattern)
+{
+    struct module_entry** loaded;
+    struct module_entry* m;
+    int count, i;
+
+    /* Registers the external modules the first time */
+    registry_lock();
+    registry_unlock();
+
+    loaded = module_list(&count);
+    for (i = 0; i < count; i++)
+    {
+        m = loaded[i];
         if (pattern && !strstr(m->name, pattern)) continue;
         printf("%20s %s\n", m->name, m->version);
     }
@@ -341,33 +1159,31 @@ int libversionShow(const char* pattern)
 }
 
 /*
- * Validate other against this.
+ * Compare function for struct module_versions, orders them from lowest to
+ * highest. Used with qsort.
  */
-static int match_version(struct module_version * this, struct module_version * other) {
-        return this->major == NOVERSION ||
-                (this->exact && (
-                 (this->minor == NOVERSION && other->major == this->major) ||
-                 (this->patch == NOVERSION && other->major == this->major && other->minor == this->minor) ||
-                 (this->major == this->major && other->minor == this->minor && other->patch == this->patch))) ||
-                (!this->exact && (
-                 (this->minor == NOVERSION && other->major >= this->major) ||
-                 (this->patch == NOVERSION && other->major == other->major && other->minor >= this->minor) ||
-                 (other->major == this->major && other->minor == this->minor && other->patch >= this->patch)));
-
+static int compare_versions(const void * a, const void * b) {
+        const struct module_version *this = a;
+        const struct module_version *other = b;
+        if (this->major != other->major)
+                return this->major < other->major ? -1 : 1;
+        if (this->minor != other->minor)
+                return this->minor < other->minor ? -1 : 1;
+        if (this->patch != other->patch)
+                return this->patch < other->patch ? -1 : 1;
+        return 0;
 }
 
 /*
- * Convert string to struct module_version.
+ * Convert string to struct module_version. Missing parts are NOVERSION.
  *
  * @param version String to be converted.
- * @param exact 0 - higher version OK, 1 - higher version not OK.
  * @param res Store result here.
  */
 
 static void ver_conv(const char * version, struct module_version * res)
 {
         int matches = sscanf(version, "%d.%d.%d", &(res->major), &(res->minor), &(res->patch));
-        res->exact = version[strlen(version)-1] == '+' ? 0 : 1;
         switch(matches) {
         case 2:
                 if(res->major < 0 || res->minor < 0)
@@ -393,9 +1209,179 @@ static void ver_conv(const char * version, struct module_version * res)
         }
 }
 
+/*
+ * A version requirement compiled to the numbered versions it accepts, from
+ * low up to but not including high, or to a version name which only matches
+ * itself. Checking a version against it takes two comparisons.
+ */
+struct version_range {
+        struct module_version low;
+        struct module_version high;
+        const char *name;     /* Named version or NULL, points into the requirement */
+};
+
+/*
+ * Lowest version above all versions which share the first n parts with v.
+ */
+static void bump_version(struct module_version *v, int n) {
+        int *part[3];
+        int i;
+
+        part[0] = &v->major;
+        part[1] = &v->minor;
+        part[2] = &v->patch;
+        if(*part[n - 1] == INT_MAX) {
+                return;
+        }
+        (*part[n - 1])++;
+        for(i = n; i < 3; i++) {
+                *part[i] = 0;
+        }
+}
+
+/*
+ * Compile a version requirement:
+ *
+ *   ""        any numbered version
+ *   1.2.3     1.2.3 exactly, 1.2 is any 1.2.x and 1 is any 1.x.x
+ *   1.2.3+    1.2.3 or a higher patch level, 1.2+ is 1.2.0 up to 2.0.0
+ *             and 1+ is 1.0.0 or higher
+ *   =1.2.3    like 1.2.3
+ *   >=1.2.3   1.2.3 or higher, >1.2.3 higher than 1.2.3, >1.2 is 1.3.0 or
+ *             higher
+ *   <1.2.3    lower than 1.2.3, <=1.2 is lower than 1.3.0
+ *   ~1.2.3    1.2.3 up to 1.3.0, ~1 is any 1.x.x
+ *   ^1.2.3    1.2.3 up to the next change of the leftmost non-zero part:
+ *             2.0.0 here, 0.3.0 for ^0.2.3
+ *   name      the named version, like "test"
+ *
+ * Returns -1 if the requirement can't be parsed.
+ */
+static int compile_version(const char *spec, struct version_range *r) {
+        static const char *operators[] = { ">=", "<=", ">", "<", "=", "~", "^", "" };
+        struct module_version v = { 0, 0, 0 };
+        int *part[3];
+        const char *op, *p;
+        int n, len;
+
+        r->low.major = r->low.minor = r->low.patch = 0;
+        r->high.major = r->high.minor = r->high.patch = INT_MAX;
+        r->name = NULL;
+        if(!spec || spec[0] == '\0') {
+                return 0;
+        }
+        if(!strchr("<>=~^", spec[0]) && !isdigit((unsigned char)spec[0])) {
+                r->name = spec;
+                return 0;
+        }
+        for(n = 0; strncmp(spec, operators[n], strlen(operators[n])) != 0; n++);
+        op = operators[n];
+        p = spec + strlen(op);
+
+        part[0] = &v.major;
+        part[1] = &v.minor;
+        part[2] = &v.patch;
+        for(n = 0; n < 3; n++) {
+                if(!isdigit((unsigned char)*p) || sscanf(p, "%d%n", part[n], &len) != 1) {
+                        return -1;
+                }
+                p += len;
+                if(*p != '.') break;
+                p++;
+        }
+        if(n == 3) {
+                return -1;
+        }
+        n++;
+        if(*p == '+' && op[0] == '\0') {
+                p++;
+                op = "+";
+        }
+        if(*p != '\0') {
+                return -1;
+        }
+
+        r->low = v;
+        r->high = v;
+        switch(op[0]) {
+        case '\0':
+        case '=':
+                bump_version(&r->high, n);
+                break;
+        case '+':
+                if(n == 1) r->high.major = r->high.minor = r->high.patch = INT_MAX;
+                else bump_version(&r->high, n - 1);
+                break;
+        case '>':
+                if(op[1] == '\0') bump_version(&r->low, n);
+                r->high.major = r->high.minor = r->high.patch = INT_MAX;
+                break;
+        case '<':
+                if(op[1] == '=') bump_version(&r->high, n);
+                r->low.major = r->low.minor = r->low.patch = 0;
+                break;
+        case '~':
+                bump_version(&r->high, n == 1 ? 1 : 2);
+                break;
+        case '^':
+                bump_version(&r->high, v.major > 0 || n == 1 ? 1 : v.minor > 0 || n == 2 ? 2 : 3);
+                break;
+        }
+        return 0;
+}
+
+static int version_in_range(const struct version_range *r, const struct module_version *v) {
+        return !r->name && compare_versions(v, &r->low) >= 0 && compare_versions(v, &r->high) < 0;
+}
+
+static int version_matches(const struct version_range *r, const char *version) {
+        struct module_version v;
+
+        if(r->name) {
+                return strcmp(r->name, version) == 0;
+        }
+        if(!isdigit((unsigned char)version[0])) {
+                return 0;
+        }
+        ver_conv(version, &v);
+        return version_in_range(r, &v);
+}
+
+/*
+ * Check a version against a requirement. Returns 1 if it matches, 0 if not
+ * and -1 if the requirement can't be parsed.
+ */
+int requireVersionMatch(const char* spec, const char* version)
+{
+        struct version_range r;
+
+        if(compile_version(spec, &r) != 0) {
+                return -1;
+        }
+        return version_matches(&r, version);
+}
+
+/*
+ * Order two versions, numbered versions from lowest to highest after named
+ * versions in alphabetical order.
+ */
+int requireVersionCompare(const char* a, const char* b)
+{
+        struct module_version va, vb;
+        int numa = isdigit((unsigned char)a[0]) != 0;
+        int numb = isdigit((unsigned char)b[0]) != 0;
+
+        if(!numa || !numb) {
+                return numa != numb ? numa - numb : strcmp(a, b);
+        }
+        ver_conv(a, &va);
+        ver_conv(b, &vb);
+        return compare_versions(&va, &vb);
+}
+
 static int validate(const char* module, const char* version, const char* loaded)
 {
-        struct module_version version_i, loaded_i;
+        struct version_range range;
 
         if (!version || version[0] == '\0' || strcmp(loaded, version) == 0) {
                 /* no version requested or exact match */
@@ -407,37 +1393,21 @@ static int validate(const char* module, const char* version, const char* loaded)
                                 module, loaded, version);
                 return 0;
         }
-        ver_conv(version, &version_i);
-        ver_conv(loaded, &loaded_i);
-
-        if (match_version(&version_i, &loaded_i)) {
+        if (compile_version(version, &range) != 0) {
+                fprintf(stderr, "require: Invalid version %s of %s requested.\n", version, module);
+                return -1;
+        }
+        if (version_matches(&range, loaded)) {
                 return 0;
         }
         return -1;
 }
 
-/* require (module)
-Look if module is already loaded.
-If module is already loaded check for version mismatch.
-If module is not yet loaded load the library with ld,
-load <module>.dbd with dbLoadDatabase (if file exists)
-and call <module>_registerRecordDeviceDriver function.
-
-If require is called from the iocsh before iocInit and fails,
-it calls epicsExit to abort the application.
-*/
-
-/* wrapper to abort statup script */
-int require(const char* module, const char* ver)
+/*
+ * Abort the startup script if require failed before iocInit.
+ */
+static int require_status(int status)
 {
-    int status;
-    if (firstTime)
-    {
-        firstTime=0;
-        registerExternalModules();
-    }
-
-    status = require_priv(module, ver);
     if (status != 0 && !interruptAccept)
     {
         /* require failed in startup script before iocInit */
@@ -454,18 +1424,26 @@ int require(const char* module, const char* ver)
     return 0;
 }
 
-/*
- * Compare function for struct module_versions. Used with qsort.
- */
-static int compare_versions(const void * a, const void * b) {
-        const struct module_version *this = a;
-        const struct module_version *other = b;
-        return this->major > other->major ||
-                (this->major == other->major &&
-                 this->minor > other->minor ) ||
-                (this->major == other->major &&
-                 this->minor == other->minor &&
-                 this->patch > other->patch );
+/* require (module)
+Look if module is already loaded.
+If module is already loaded check for version mismatch.
+If module is not yet loaded load the library with ld,
+load <module>.dbd with dbLoadDatabase (if file exists)
+and call <module>_registerRecordDeviceDriver function.
+
+If require is called from the iocsh before iocInit and fails,
+it calls epicsExit to abort the application.
+*/
+
+/* wrapper to abort statup script */
+int require(const char* module, const char* ver)
+{
+    int status;
+
+    trace_begin("require", module);
+    status = require_priv(module, ver);
+    trace_end();
+    return require_status(status);
 }
 
 /*
@@ -520,402 +1498,4259 @@ static int find_default(const char * module, const char *defaultdep, char * vers
         return 0;
 }
 
-static int arch_installed(const char *module, const char *moduledir) {
-        char depfile[256];
+/*
+ * Batched file system probing. Finding a module stats many candidate paths,
+ * one after the other. On a cold NFS tree every stat is a round trip to the
+ * server, so all paths of a batch are probed at once: with io_uring statx
+ * where the kernel has it, else with a few threads, else one at a time.
+ * When the first stat of a batch returns faster than a round trip, the
+ * metadata is cached and the rest is probed one at a time as well.
+ * REQUIRE_PROBE=uring, threads or serial selects a method, for comparisons.
+ */
+struct probe {
+        char path[256];
+        int found;
+        long long size;
+};
+
+#define PROBETHREADS 8
+#define PROBEBATCHMIN 4    /* Smaller batches are probed one at a time */
+#define PROBEWARM 20e-6    /* A stat faster than this did not go to the server */
+
+static void probe_serial(struct probe *probes, int count)
+{
         struct stat filestat;
-        snprintf(depfile, sizeof(depfile), "%s" DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A DIRSEP "%s.dep", moduledir, module);
-        return stat(depfile, &filestat) == 0;
+        int i;
+        for (i = 0; i < count; i++) {
+                probes[i].found = stat(probes[i].path, &filestat) == 0;
+                probes[i].size = probes[i].found ? (long long)filestat.st_size : 0;
+        }
 }
 
-int require_priv(const char* module, const char* vers)
-{
-    char module_incpath[512];
-    char version[20];
-    struct module_version version_i;
-    const char* loaded;
-    struct stat filestat;
-    HMODULE libhandle;
-    char *end; /* end of string */
-    const char sep[1] = PATHSEP;
+#if defined (__linux__) && defined (STATX_SIZE)
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+#define PROBE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
 
-    char *epicsmodules = getenv("EPICS_MODULES_PATH");
-    if(!epicsmodules) {
-            fprintf(stderr, "require: EPICS_MODULES_PATH is not in environment.\n");
-            return -1;
-    }
-    char *p = getenv("EPICS_MODULE_INCLUDE_PATH");
-    if(p) {
-            strncpy(module_incpath, p, 511);
-    } else {
-            strcat(module_incpath, ".");
-    }
+#ifdef PROBE_URING
+#define URINGENTRIES 64
 
-    debug_print("checking module %s version %s.\n", module, vers);
-    if (!module)
-    {
-        printf("Usage: require \"<module>\" [, \"<version>\"].\n");
-        printf("Loads  resources from %s/<module>/<version>.\n", epicsmodules);
-        return -1;
-    }
+/*
+ * A minimal io_uring, set up once and only used while resolving modules,
+ * with registryLock held. Only the ring layout of the kernel ABI is needed,
+ * not liburing.
+ */
+static struct uring {
+        int fd;
+        unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+        unsigned *cqhead, *cqtail, *cqmask;
+        struct io_uring_sqe *sqes;
+        struct io_uring_cqe *cqes;
+        unsigned entries;
+} uring = { -2, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0 };
 
-    memset(version, 0, sizeof(version));
-    if (vers) strncpy(version, vers, sizeof(version));
+static int uring_open(void)
+{
+        struct io_uring_params params;
+        char *sq, *cq;
+        size_t sqsize, cqsize;
 
-    loaded = getLibVersion(module);
-    if (loaded)
-    {
-        debug_print("loaded version of %s is %s.\n",
-                module, loaded);
-        /* Library already loaded. Check Version. */
-        if (validate(module, version, loaded) != 0)
-        {
-            printf("Conflict between requested %s version %s\n"
-                "and already loaded version %s.\n",
-                module, version, loaded);
-            return -1;
+        if (uring.fd != -2) {
+                return uring.fd;
         }
-        /* Loaded version is ok */
-        debug_print("%s %s already loaded.\n", module, loaded);
-        return 0;
-    }
-    else
-    {
-        const int size = 256;   /* Max size of strings */
-        char modulepath[size];  /* Path to loaded module */
-        char libname[size];     /* Path to library file */
-        char dbdname[size];     /* Path to dbd file */
-        char depname[size];     /* Path to dep file */
-        char dbname[size];      /* Path to db folder. */
-        char startupname[size]; /* Path to startup folder. */
-        char binname[size];     /* Path to bin folder. */
-        char miscname[size];    /* Path to misc folder. */
-        char symbolname[size];  /* Magic symbol name */
-
-        char epics_db_include_path[1024];        /* EPICS env variable */
-        char require_startup_include_path[1024]; /* require env variable */
-        char require_bin_include_path[1024];     /* require env variable */
-        char stream_protocol_path[1024];         /* streamdevice env variable */
-
-        char *p = version;
-        DIR *dir;
-        struct dirent* ent;
-        int tmp;
-        char tmp_str[size];
+        memset(&params, 0, sizeof(params));
+        uring.fd = syscall(__NR_io_uring_setup, URINGENTRIES, &params);
+        if (uring.fd < 0) {
+                debug_print("No io_uring: %s.\n", strerror(errno));
+                return uring.fd = -1;
+        }
+        sqsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        sq = mmap(NULL, sqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+        cq = mmap(NULL, cqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+        uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+        if (sq == MAP_FAILED || cq == MAP_FAILED || uring.sqes == MAP_FAILED) {
+                debug_print("Can't map io_uring: %s.\n", strerror(errno));
+                close(uring.fd);
+                return uring.fd = -1;
+        }
+        uring.sqhead = (unsigned *)(sq + params.sq_off.head);
+        uring.sqtail = (unsigned *)(sq + params.sq_off.tail);
+        uring.sqmask = (unsigned *)(sq + params.sq_off.ring_mask);
+        uring.sqarray = (unsigned *)(sq + params.sq_off.array);
+        uring.cqhead = (unsigned *)(cq + params.cq_off.head);
+        uring.cqtail = (unsigned *)(cq + params.cq_off.tail);
+        uring.cqmask = (unsigned *)(cq + params.cq_off.ring_mask);
+        uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+        uring.entries = params.sq_entries;
+        return uring.fd;
+}
 
-        modulepath[0] = '\0';
-        tmp_str[0] = '\0';
+/*
+ * Probe with one io_uring submission per URINGENTRIES paths. Returns -1 if
+ * io_uring can't be used, then nothing has been probed.
+ */
+static int probe_uring(struct probe *probes, int count)
+{
+        struct statx *results;
+        int done, n, i;
 
-        /*
-         * Check if any module in the current dir implements this module.
-         */
-        if(version[0] == '\0' || strcmp(version, "local") == 0) {
-                if((dir = opendir(LOC_MODULES))) {
-                        debug_print("%s","Looking for modules in \"" LOC_MODULES "\".\n");
-                        while((ent = readdir(dir))){
-                                sprintf(tmp_str, LOC_MODULES DIRSEP "%s" DIRSEP BUILDDIR, ent->d_name);
-                                if(arch_installed(module, tmp_str)) {
-                                        strcat(version, "local");
-                                        strcpy(modulepath, tmp_str);
-                                        debug_print("Found (local) in %s.\n", ent->d_name);
-                                        break;
-                                }
-                        }
-                        closedir(dir);
-                }
+        if (uring_open() < 0 || !(results = calloc(count, sizeof(struct statx)))) {
+                return -1;
         }
-
-        /*
-         * If user requested a named (and not numbered) version, try to find it.
-         */
-        char ch;
-        if(version[0] != '\0' && sscanf(version, "%d.%d.%d%c", &tmp, &tmp, &tmp, &ch) != 3) {
-                sprintf(tmp_str, "%s" DIRSEP "%s" DIRSEP "%s", epicsmodules, module, version);
-                if(arch_installed(module, tmp_str)) {
-                        strcpy(modulepath, tmp_str);
-                        debug_print("Found named version (%s).\n", version);
+        for (done = 0; done < count; done += n) {
+                unsigned tail = *uring.sqtail;
+                unsigned head;
+                n = count - done < (int)uring.entries ? count - done : (int)uring.entries;
+                for (i = 0; i < n; i++) {
+                        unsigned index = (tail + i) & *uring.sqmask;
+                        struct io_uring_sqe *sqe = &uring.sqes[index];
+                        memset(sqe, 0, sizeof(*sqe));
+                        sqe->opcode = IORING_OP_STATX;
+                        sqe->fd = AT_FDCWD;
+                        sqe->addr = (unsigned long)probes[done + i].path;
+                        sqe->len = STATX_TYPE | STATX_SIZE;
+                        sqe->off = (unsigned long)&results[done + i];
+                        sqe->user_data = done + i;
+                        uring.sqarray[index] = index;
                 }
-        }
-
-        /*
-         * If user didn't request a specific version, look in dependency files.
-         */
-        char *epicsbase = getenv("EPICS_BASE");
-        if (version[0] == '\0' && epicsbase)
-        {
-                sprintf(tmp_str, "%s" DIRSEP "configure" DIRSEP "default." T_A ".dep", epicsbase);
-                int found = find_default(module, tmp_str, version);
-                if (!found) {
-                        sprintf(tmp_str, "%s" DIRSEP "configure" DIRSEP "default.dep", epicsbase);
-                        found = find_default(module, tmp_str, version);
+                __atomic_store_n(uring.sqtail, tail + n, __ATOMIC_RELEASE);
+                if (syscall(__NR_io_uring_enter, uring.fd, n, n, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+                        /* The queue is in an unknown state, never use it again */
+                        debug_print("io_uring failed: %s.\n", strerror(errno));
+                        close(uring.fd);
+                        uring.fd = -1;
+                        free(results);
+                        return -1;
                 }
-        } else {
-                debug_print("%s","EPICS_BASE not defined.\n");
-        }
-
-        ver_conv(version, &version_i);
-        debug_print("Version (%s) (%d,%d,%d,%c).\n", version, version_i.major, version_i.minor, version_i.patch, version_i.exact == 0 ? '+' : ' ');
-
-
-        /*
-         * If there still isn't a candidate, find all installed versions of the
-         * module, sort them and pick the highest valid version.
-         */
-        if(modulepath[0] == '\0') {
-                struct module_version inst_vers[20];
-                int vers_c = 0;
-                sprintf(tmp_str, "%s" DIRSEP "%s", epicsmodules, module);
-                if((dir = opendir(tmp_str))) {
-                        debug_print("Looking for versions in %s.\n", tmp_str);
-                        while((ent = readdir(dir))){
-                                int tmp;
-                                char ch;
-                                if(sscanf(ent->d_name, "%d.%d.%d%c", &tmp, &tmp, &tmp, &ch) != 3) {
-                                        continue;
-                                }
-                                snprintf(tmp_str, size, "%s" DIRSEP "%s" DIRSEP "%s", epicsmodules, module, ent->d_name);
-                                if(!arch_installed(module, tmp_str)) {
-                                        debug_print("Found (%s), not available on this platform.\n", ent->d_name);
-                                        continue;
-                                }
-                                ver_conv(ent->d_name, &(inst_vers[vers_c]));
-                                debug_print("Found (%d.%d.%d).\n", inst_vers[vers_c].major, inst_vers[vers_c].minor, inst_vers[vers_c].patch);
-                                ++vers_c;
+                for (i = 0; i < n; i++) {
+                        struct io_uring_cqe *cqe;
+                        struct probe *p;
+                        head = *uring.cqhead;
+                        while (head == __atomic_load_n(uring.cqtail, __ATOMIC_ACQUIRE)) {
+                                syscall(__NR_io_uring_enter, uring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
                         }
-                        closedir(dir);
-                } else {
-                        debug_print("Failed to open %s.\n", tmp_str);
-                }
-                if(vers_c > 0 ) {
-                        qsort(inst_vers, vers_c, sizeof (struct module_version), compare_versions);
-                        int i;
-                        for(i=vers_c-1;i>=0;--i) {
-                                if(match_version(&version_i, &(inst_vers[i]))) {
-                                        sprintf(version, "%d.%d.%d", inst_vers[i].major, inst_vers[i].minor, inst_vers[i].patch);
-                                        snprintf(modulepath, size, "%s" DIRSEP "%s" DIRSEP "%s", epicsmodules, module, version);
-                                        debug_print("Chosen (%s).\n", version);
-                                        break;
-                                }
+                        cqe = &uring.cqes[head & *uring.cqmask];
+                        p = &probes[cqe->user_data];
+                        if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+                                /* Kernel without statx in io_uring */
+                                probe_serial(p, 1);
+                        } else {
+                                p->found = cqe->res == 0;
+                                p->size = p->found ? (long long)results[cqe->user_data].stx_size : 0;
                         }
+                        __atomic_store_n(uring.cqhead, head + 1, __ATOMIC_RELEASE);
                 }
         }
+        free(results);
+        return 0;
+}
+#else
+static int probe_uring(struct probe *probes, int count)
+{
+        return -1;
+}
+#endif
+
+#if defined (__unix__)
+struct probe_batch {
+        struct probe *probes;
+        int count;
+        int next;
+        int running;
+        epicsMutexId lock;
+        epicsEventId done;
+};
+
+/*
+ * The probe threads are started with the first batch and then wait for
+ * the next one. Batches come one at a time, with registryLock held.
+ */
+static struct probe_pool {
+        struct probe_batch batch;
+        epicsEventId start[PROBETHREADS];
+        int threads;            /* Started, not counting the calling thread */
+        int failed;             /* Could not be set up */
+} probePool;
+
+static void probe_batch(struct probe_batch *batch)
+{
+        struct stat filestat;
+        int i, last;
+
+        for (;;) {
+                epicsMutexMustLock(batch->lock);
+                i = batch->next < batch->count ? batch->next++ : -1;
+                last = i < 0 && --batch->running == 0;
+                epicsMutexUnlock(batch->lock);
+                if (i < 0) break;
+                batch->probes[i].found = fstatat(AT_FDCWD, batch->probes[i].path, &filestat, 0) == 0;
+                batch->probes[i].size = batch->probes[i].found ? (long long)filestat.st_size : 0;
+        }
+        if (last) epicsEventSignal(batch->done);
+}
+
+static void probe_worker(void *arg)
+{
+        epicsEventId start = arg;
+
+        for (;;) {
+                epicsEventMustWait(start);
+                probe_batch(&probePool.batch);
+        }
+}
+
+static int probe_pool_start(void)
+{
+        struct probe_pool *pool = &probePool;
+
+        if (pool->failed || pool->batch.lock) {
+                return pool->failed ? -1 : 0;
+        }
+        if (!(pool->batch.lock = epicsMutexCreate()) || !(pool->batch.done = epicsEventCreate(epicsEventEmpty))) {
+                if (pool->batch.lock) epicsMutexDestroy(pool->batch.lock);
+                pool->batch.lock = NULL;
+                pool->failed = 1;
+                return -1;
+        }
+        while (pool->threads < PROBETHREADS - 1) {
+                if (!(pool->start[pool->threads] = epicsEventCreate(epicsEventEmpty))) break;
+                if (!epicsThreadCreate("requireProbe", epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackSmall), probe_worker, pool->start[pool->threads])) {
+                        epicsEventDestroy(pool->start[pool->threads]);
+                        break;
+                }
+                pool->threads++;
+        }
+        debug_print("Started %d probe threads.\n", pool->threads);
+        return 0;
+}
+
+/*
+ * Probe with the threads of the pool and the calling thread. Returns -1 if
+ * the pool can't be set up, then nothing has been probed.
+ */
+static int probe_threads(struct probe *probes, int count)
+{
+        struct probe_batch *batch = &probePool.batch;
+        int i, n;
+
+        if (probe_pool_start() != 0) {
+                return -1;
+        }
+        n = count - 1 < probePool.threads ? count - 1 : probePool.threads;
+        epicsMutexMustLock(batch->lock);
+        batch->probes = probes;
+        batch->count = count;
+        batch->next = 0;
+        batch->running = 1 + n;
+        epicsMutexUnlock(batch->lock);
+        for (i = 0; i < n; i++) {
+                epicsEventSignal(probePool.start[i]);
+        }
+        probe_batch(batch);
+        epicsEventMustWait(batch->done);
+        return 0;
+}
+#else
+static int probe_threads(struct probe *probes, int count)
+{
+        return -1;
+}
+#endif
+
+/*
+ * Stat all paths of probes. Sets found, and size for the paths found.
+ */
+static void probe_paths(struct probe *probes, int count)
+{
+        const char *method = getenv("REQUIRE_PROBE");
+        double start = monotonic();
+        int total = count;
+        int status = -1;
+
+        if (count == 0) {
+                return;
+        }
+        if (count < PROBEBATCHMIN) {
+                method = "serial";
+        }
+        if (!method) {
+                /* With the metadata cached a batch costs more than it saves */
+                probe_serial(probes, 1);
+                if (monotonic() - start < PROBEWARM) {
+                        method = "serial";
+                }
+                probes++;
+                count--;
+        }
+        if (!method || strcmp(method, "uring") == 0) {
+                status = probe_uring(probes, count);
+        }
+        if (status != 0 && (!method || strcmp(method, "serial") != 0)) {
+                status = probe_threads(probes, count);
+        }
+        if (status != 0) {
+                probe_serial(probes, count);
+        }
+        debug_print("Probed %d paths in %.3f ms.\n", total, (monotonic() - start) * 1000);
+}
+
+static int arch_installed(const char *module, const char *moduledir) {
+        char depfile[256];
+        struct stat filestat;
+        if((size_t)snprintf(depfile, sizeof(depfile), "%s" DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A DIRSEP "%s.dep", moduledir, module) >= sizeof(depfile)) {
+                fprintf(stderr, "require: Path of %s in %s is too long.\n", module, moduledir);
+                return 0;
+        }
+        return stat(depfile, &filestat) == 0;
+}
+
+/*
+ * What an installed module version provides. CONTENTS_UNKNOWN means that the
+ * version was found by scanning the file system and every part has to be
+ * checked with stat().
+ */
+#define CONTENTS_UNKNOWN     -1
+#define CONTENTS_LIB       0x01
+#define CONTENTS_DBD       0x02
+#define CONTENTS_DB        0x04
+#define CONTENTS_STARTUP   0x08
+#define CONTENTS_BIN       0x10
+#define CONTENTS_MISC      0x20
+
+static const struct {
+        const char *name;
+        int flag;
+} contentNames[] = {
+        { "lib",     CONTENTS_LIB },
+        { "dbd",     CONTENTS_DBD },
+        { "db",      CONTENTS_DB },
+        { "startup", CONTENTS_STARTUP },
+        { "bin",     CONTENTS_BIN },
+        { "misc",    CONTENTS_MISC },
+};
+
+struct installed_version {
+        struct module_version version;
+        int contents;
+};
+
+/*
+ * Growable list of installed versions of a module.
+ */
+struct version_list {
+        struct installed_version *versions;
+        int count;
+        int size;
+};
+
+static struct installed_version *add_version(struct version_list *list) {
+        struct installed_version *v;
+        if(!(v = grow(list->versions, &list->size, list->count, sizeof(struct installed_version)))) {
+                return NULL;
+        }
+        list->versions = v;
+        return &list->versions[list->count++];
+}
+
+/*
+ * Sort a list of installed versions from lowest to highest.
+ */
+static void sort_versions(struct version_list *list) {
+        qsort(list->versions, list->count, sizeof(struct installed_version), compare_versions);
+}
+
+/*
+ * Find the highest version in a sorted list which matches the requested
+ * version. The versions matching a request are always a contiguous range of
+ * the sorted list, so this is a binary search for the last version below the
+ * upper end of that range. Returns the index or -1.
+ */
+static int highest_match(const struct version_list *list, const struct version_range *requested) {
+        int lo = 0, hi = list->count;
+
+        /* First version at or above the upper end */
+        while(lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if(compare_versions(&list->versions[mid].version, &requested->high) < 0) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        if(lo > 0 && version_in_range(requested, &list->versions[lo - 1].version)) {
+                return lo - 1;
+        }
+        return -1;
+}
+
+/*
+ * Check if a module provides a part (library, dbd file, db folder, ...). Only
+ * touches the file system if the contents of the module are unknown.
+ */
+static int module_has(int contents, int part, const char *path) {
+        struct stat filestat;
+        if(contents != CONTENTS_UNKNOWN) {
+                return (contents & part) != 0;
+        }
+        if(stat(path, &filestat) != 0) {
+                return 0;
+        }
+        /* Empty dbd files are not loaded */
+        return part != CONTENTS_DBD || filestat.st_size > 0;
+}
+
+/*
+ * Compose the file name of a part of the module installed in modulepath.
+ * Returns -1 and leaves buffer empty if the name does not fit.
+ */
+static int part_path(char *buffer, size_t size, const char *modulepath, const char *module, int part) {
+        int n;
+        switch(part) {
+        case CONTENTS_LIB:
+                n = snprintf(buffer, size, "%s" DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A DIRSEP PREFIX "%s" INFIX EXT, modulepath, module);
+                break;
+        case CONTENTS_DBD:
+                n = snprintf(buffer, size, "%s" DIRSEP EPICSVERSION DIRSEP "dbd" DIRSEP "%s.dbd", modulepath, module);
+                break;
+        case CONTENTS_DB:
+                n = snprintf(buffer, size, "%s" DIRSEP "db", modulepath);
+                break;
+        case CONTENTS_STARTUP:
+                n = snprintf(buffer, size, "%s" DIRSEP "startup", modulepath);
+                break;
+        case CONTENTS_BIN:
+                n = snprintf(buffer, size, "%s" DIRSEP EPICSVERSION DIRSEP "bin" DIRSEP T_A, modulepath);
+                break;
+        case CONTENTS_MISC:
+                n = snprintf(buffer, size, "%s" DIRSEP "misc", modulepath);
+                break;
+        default:
+                buffer[0] = '\0';
+                return 0;
+        }
+        if(n < 0 || (size_t)n >= size) {
+                fprintf(stderr, "require: Path of %s in %s is too long.\n", module, modulepath);
+                buffer[0] = '\0';
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * Index of all installed modules, written by module_manager.py into the root
+ * of EPICS_MODULES_PATH. After a header line with the format version there is
+ * one line per installed module, version, EPICS version and architecture,
+ * sorted by module name:
+ *
+ *   <module> <version> <EPICSVERSION> <T_A> <content>[,<content>...]
+ *
+ * The content list names the parts in contentNames, or is '-' if empty. The
+ * index is mapped once and searched in place. It is only trusted for modules
+ * whose directory is older than the index, otherwise require falls back to
+ * scanning the directory. The resolver is asked again in each require call,
+ * so modules installed meanwhile are seen, but sends the index again only if
+ * it changed. The listing of
+ * the root and the index file are read again in a require call when the
+ * root or the file has changed.
+ */
+struct module_index {
+        char path[256];   /* Index file this mapping belongs to */
+        const char *data; /* NULL if the index is not available */
+        size_t size;
+        time_t mtime;
+        ino_t ino;
+        const char **modules; /* Sorted module directories of the root */
+        int nmodules;
+        int modulessize;
+        int listed;       /* 0 if the root could not be listed */
+        dev_t rootdev;    /* The root when it was listed */
+        ino_t rootino;
+        time_t rootmtime;
+        time_t listtime;
+        int trusted;      /* Index from the resolver, up to date when fetched */
+        char serial[64];  /* Of the index from the resolver */
+        unsigned int generation; /* require call which last checked the index */
+};
+
+/*
+ * One index and listing per root of EPICS_MODULES_PATH, kept for the life of
+ * the process. The generation counts the require calls.
+ */
+static struct {
+        struct module_index **roots;
+        int count;
+        int size;
+        unsigned int generation;
+} moduleIndexes;
+
+#define INDEX_FIELDS 5
+
+/*
+ * Split the index line starting at p into its fields. Returns the start of the
+ * next line.
+ */
+static const char *index_line(const char *p, const char *end, const char *field[], int len[]) {
+        int i;
+        for(i = 0; i < INDEX_FIELDS; i++) {
+                while(p < end && *p == ' ') p++;
+                field[i] = p;
+                while(p < end && *p != ' ' && *p != '\n') p++;
+                len[i] = (int)(p - field[i]);
+        }
+        while(p < end && *p != '\n') p++;
+        return p < end ? p + 1 : end;
+}
+
+/*
+ * Compare the first field of the index line at p with name, like strcmp().
+ */
+static int index_compare(const char *p, const char *end, const char *name) {
+        while(p < end && *p != ' ' && *p != '\n' && *name && *p == *name) {
+                p++;
+                name++;
+        }
+        if(p == end || *p == ' ' || *p == '\n') {
+                return *name ? -1 : 0;
+        }
+        return (unsigned char)*p - (unsigned char)*name;
+}
+
+static int index_contents(const char *p, int len) {
+        int contents = 0;
+        const char *end = p + len;
+        unsigned int i;
+        while(p < end) {
+                const char *q = p;
+                while(q < end && *q != ',') q++;
+                for(i = 0; i < sizeof(contentNames)/sizeof(contentNames[0]); i++) {
+                        if(strlen(contentNames[i].name) == (size_t)(q - p) &&
+                           strncmp(contentNames[i].name, p, q - p) == 0) {
+                                contents |= contentNames[i].flag;
+                        }
+                }
+                p = q + 1;
+        }
+        return contents;
+}
+
+static int compare_names(const void *a, const void *b) {
+        return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/*
+ * Read the module directories of a root once, so that roots which don't have
+ * a module are skipped without touching the file system again.
+ */
+static void index_list(struct module_index *idx, const char *epicsmodules) {
+        struct stat filestat;
+        DIR *dir;
+        struct dirent *ent;
+        const char **modules;
+
+        if(stat(epicsmodules, &filestat) != 0 || !(dir = opendir(epicsmodules))) {
+                debug_print("Can't list %s.\n", epicsmodules);
+                return;
+        }
+        while((ent = readdir(dir))) {
+                if(ent->d_name[0] == '.') continue;
+                if(!(modules = grow(idx->modules, &idx->modulessize, idx->nmodules, sizeof(const char *)))) {
+                        goto fail;
+                }
+                idx->modules = modules;
+                if(!(modules[idx->nmodules] = intern(ent->d_name))) {
+                        goto fail;
+                }
+                idx->nmodules++;
+        }
+        closedir(dir);
+        qsort(idx->modules, idx->nmodules, sizeof(const char *), compare_names);
+        idx->listed = 1;
+        idx->rootdev = filestat.st_dev;
+        idx->rootino = filestat.st_ino;
+        idx->rootmtime = filestat.st_mtime;
+        idx->listtime = time(NULL);
+        debug_print("Listed %d modules in %s.\n", idx->nmodules, epicsmodules);
+        return;
+fail:
+        /* Without a complete listing every module is looked for */
+        free(idx->modules);
+        idx->modules = NULL;
+        idx->nmodules = idx->modulessize = 0;
+        closedir(dir);
+}
+
+static void index_clear(struct module_index *idx);
+
+#if defined (__unix__)
+/*
+ * Ask the resolver (scripts/require_resolver.py) for the index of the root
+ * epicsmodules. It is shared by all IOCs on the host and keeps its indexes up
+ * to date, so its answer is trusted without looking at the module directories
+ * until the next require call. The request is the root and the serial of the
+ * index idx already has, the answer the serial of the current index and, if
+ * that is another one, the index:
+ *   serial <serial>
+ *   [<index>]
+ * The resolver is only asked if REQUIRE_RESOLVER names its socket, and only
+ * if the socket belongs to root, to the user of the IOC or to the owner of
+ * epicsmodules, so that no other user can serve an index. Returns 1 if idx
+ * holds the current index from the resolver, 0 if the resolver is not
+ * running or does not serve this root.
+ */
+static int resolver_index(struct module_index *idx, const char *epicsmodules)
+{
+        struct sockaddr_un addr;
+        struct timeval timeout = { 2, 0 };
+        struct stat sockstat, rootstat;
+        const char *path = getenv("REQUIRE_RESOLVER");
+        char serial[sizeof(idx->serial)];
+        char *buffer = NULL, *index;
+        int buffersize = 0;
+        size_t len = 0;
+        ssize_t n = 0;
+        int fd;
+
+        if (!path || path[0] == '\0' || strlen(path) >= sizeof(addr.sun_path)) {
+                return 0;
+        }
+        if (lstat(path, &sockstat) != 0 || !S_ISSOCK(sockstat.st_mode)) {
+                debug_print("No resolver at %s.\n", path);
+                return 0;
+        }
+        if (sockstat.st_uid != 0 && sockstat.st_uid != geteuid() &&
+            (stat(epicsmodules, &rootstat) != 0 || sockstat.st_uid != rootstat.st_uid)) {
+                fprintf(stderr, "require: Ignoring resolver %s, it belongs to user %d.\n",
+                        path, (int)sockstat.st_uid);
+                return 0;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+                return 0;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                debug_print("No resolver at %s.\n", path);
+                close(fd);
+                return 0;
+        }
+        /* Don't let a stuck resolver hold up the boot */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (write(fd, epicsmodules, strlen(epicsmodules)) < 0 || write(fd, " ", 1) != 1 ||
+            write(fd, idx->trusted ? idx->serial : "-", strlen(idx->trusted ? idx->serial : "-")) < 0 ||
+            write(fd, "\n", 1) != 1) {
+                close(fd);
+                return 0;
+        }
+        for (;;) {
+                char *p;
+                if (!(p = grow(buffer, &buffersize, (int)len + 1, 1))) {
+                        break;
+                }
+                buffer = p;
+                if ((n = read(fd, buffer + len, buffersize - len - 1)) <= 0) {
+                        break;
+                }
+                len += n;
+        }
+        close(fd);
+        if (buffer) buffer[len] = '\0';
+        if (n < 0 || !buffer || sscanf(buffer, "serial %63s", serial) != 1 || !(index = strchr(buffer, '\n'))) {
+                debug_print("Resolver at %s has no index of %s.\n", path, epicsmodules);
+                free(buffer);
+                return 0;
+        }
+        index++;
+        len -= index - buffer;
+        if (len == 0 && idx->trusted && strcmp(serial, idx->serial) == 0) {
+                debug_print("Index of %s from resolver at %s is unchanged.\n", epicsmodules, path);
+                free(buffer);
+                return 1;
+        }
+        if (len < sizeof(INDEXHEADER)-1 || strncmp(index, INDEXHEADER, sizeof(INDEXHEADER)-1) != 0) {
+                debug_print("Resolver at %s has no index of %s.\n", path, epicsmodules);
+                free(buffer);
+                return 0;
+        }
+        debug_print("Using index of %s from resolver at %s.\n", epicsmodules, path);
+        memmove(buffer, index, len);
+        index_clear(idx);
+        idx->data = buffer;
+        idx->size = len;
+        idx->trusted = 1;
+        strcpy(idx->serial, serial);
+        return 1;
+}
+#endif
+
+/*
+ * Get the index of the root epicsmodules from the resolver, or else read the
+ * listing of the root and map its index file.
+ */
+static void index_load(struct module_index *idx, const char *epicsmodules) {
+        idx->generation = moduleIndexes.generation;
+#if defined (__unix__)
+        if (resolver_index(idx, epicsmodules)) {
+                return;
+        }
+#endif
+        index_list(idx, epicsmodules);
+#if defined (__unix__)
+        {
+                struct stat filestat;
+                void *data;
+                int fd = open(idx->path, O_RDONLY);
+                if(fd < 0) {
+                        debug_print("No module index %s.\n", idx->path);
+                        return;
+                }
+                if(fstat(fd, &filestat) != 0 || filestat.st_size < (off_t)sizeof(INDEXHEADER)-1) {
+                        close(fd);
+                        return;
+                }
+                data = mmap(NULL, filestat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                close(fd);
+                if(data == MAP_FAILED) {
+                        debug_print("Failed to map %s.\n", idx->path);
+                        return;
+                }
+                if(strncmp(data, INDEXHEADER, sizeof(INDEXHEADER)-1) != 0) {
+                        fprintf(stderr, "require: Ignoring %s, unknown index format.\n", idx->path);
+                        munmap(data, filestat.st_size);
+                        return;
+                }
+                idx->data = data;
+                idx->size = filestat.st_size;
+                idx->mtime = filestat.st_mtime;
+                idx->ino = filestat.st_ino;
+                debug_print("Using module index %s.\n", idx->path);
+        }
+#endif
+}
+
+/*
+ * Forget the listing and index of idx.
+ */
+static void index_clear(struct module_index *idx) {
+        if(idx->trusted) {
+                free((char *)idx->data);
+        }
+#if defined (__unix__)
+        else if(idx->data) {
+                munmap((void *)idx->data, idx->size);
+        }
+#endif
+        free(idx->modules);
+        idx->data = NULL;
+        idx->size = 0;
+        idx->mtime = 0;
+        idx->ino = 0;
+        idx->modules = NULL;
+        idx->nmodules = idx->modulessize = 0;
+        idx->listed = 0;
+        idx->trusted = 0;
+        idx->serial[0] = '\0';
+}
+
+/*
+ * Check if the root or its index file changed since idx was read, like
+ * find_local() does for the local modules folder. A root modified in the
+ * second it was listed may have changed after that and is listed again.
+ */
+static int index_changed(struct module_index *idx, const char *epicsmodules) {
+        struct stat filestat;
+        if(stat(epicsmodules, &filestat) != 0) {
+                return idx->listed;
+        }
+        if(!idx->listed || filestat.st_mtime != idx->rootmtime || idx->rootmtime >= idx->listtime ||
+           filestat.st_dev != idx->rootdev || filestat.st_ino != idx->rootino) {
+                return 1;
+        }
+        if(stat(idx->path, &filestat) != 0) {
+                return idx->data != NULL;
+        }
+        return !idx->data || filestat.st_mtime != idx->mtime || filestat.st_ino != idx->ino;
+}
+
+/*
+ * Get the cached listing and index of the root epicsmodules, mapping the index
+ * and reading the listing the first time. In each require call the resolver
+ * is asked again for a changed index, and the listing and index file are
+ * read again if they changed. Returns NULL if out of memory.
+ */
+static struct module_index *index_open(const char *epicsmodules) {
+        struct module_index *idx;
+        struct module_index **indexes;
+        char path[256];
+        int i;
+
+        snprintf(path, sizeof(path), "%s" DIRSEP INDEXFILE, epicsmodules);
+        for(i = 0; i < moduleIndexes.count; i++) {
+                idx = moduleIndexes.roots[i];
+                if(strcmp(path, idx->path) != 0) {
+                        continue;
+                }
+                if(idx->generation != moduleIndexes.generation) {
+#if defined (__unix__)
+                        if(idx->trusted && resolver_index(idx, epicsmodules)) {
+                                idx->generation = moduleIndexes.generation;
+                                return idx;
+                        }
+#endif
+                        if(idx->trusted || index_changed(idx, epicsmodules)) {
+                                debug_print("Reading index of %s again.\n", epicsmodules);
+                                index_clear(idx);
+                                index_load(idx, epicsmodules);
+                        }
+                        idx->generation = moduleIndexes.generation;
+                }
+                return idx;
+        }
+        if(!(indexes = grow(moduleIndexes.roots, &moduleIndexes.size, moduleIndexes.count, sizeof(struct module_index *)))) {
+                return NULL;
+        }
+        moduleIndexes.roots = indexes;
+        if(!(idx = calloc(1, sizeof(struct module_index)))) {
+                fprintf(stderr, "require: out of memory.\n");
+                return NULL;
+        }
+        moduleIndexes.roots[moduleIndexes.count++] = idx;
+        strcpy(idx->path, path);
+        index_load(idx, epicsmodules);
+        return idx;
+}
+
+/*
+ * Find the first index line of module by bisection.
+ */
+static const char *index_find(struct module_index *idx, const char *module) {
+        const char *lo = idx->data + sizeof(INDEXHEADER)-1;
+        const char *hi = idx->data + idx->size;
+        const char *end = hi;
+        while(lo < hi) {
+                const char *mid = lo + (hi - lo) / 2;
+                const char *line = mid;
+                while(line > lo && line[-1] != '\n') line--;
+                if(index_compare(line, end, module) < 0) {
+                        while(mid < end && *mid != '\n') mid++;
+                        lo = mid < end ? mid + 1 : end;
+                } else {
+                        hi = line;
+                }
+        }
+        return lo;
+}
+
+/*
+ * Returns 1 if the index can be used for module, 0 if module is not installed
+ * at all and -1 if the module directory has to be scanned.
+ */
+static int index_usable(struct module_index *idx, const char *epicsmodules, const char *module) {
+        char moduledir[256];
+        struct stat filestat;
+        if(!idx) {
+                return -1;
+        }
+        if(idx->trusted) {
+                const char *p = index_find(idx, module);
+                return p < idx->data + idx->size && index_compare(p, idx->data + idx->size, module) == 0;
+        }
+        if(idx->listed && !bsearch(&module, idx->modules, idx->nmodules, sizeof(const char *), compare_names)) {
+                return 0;
+        }
+        if(!idx->data) {
+                return -1;
+        }
+        snprintf(moduledir, sizeof(moduledir), "%s" DIRSEP "%s", epicsmodules, module);
+        if(stat(moduledir, &filestat) != 0) {
+                return 0;
+        }
+        if(filestat.st_mtime > idx->mtime) {
+                debug_print("Module index is older than %s.\n", moduledir);
+                return -1;
+        }
+        return 1;
+}
+
+/*
+ * Get the installed versions of module for this EPICS version and
+ * architecture from the index and append them to list. If version is given,
+ * only that (named) version is looked for. Returns the number of versions
+ * found or -1 if out of memory.
+ */
+static int index_versions(struct module_index *idx, const char *module, const char *version,
+                          struct version_list *list, int *contents) {
+        const char *end = idx->data + idx->size;
+        const char *p = index_find(idx, module);
+        const char *field[INDEX_FIELDS];
+        int len[INDEX_FIELDS];
+        int vers_c = 0;
+        char name[20];
+        struct installed_version *v;
+        while(p < end && index_compare(p, end, module) == 0) {
+                p = index_line(p, end, field, len);
+                if(len[2] != sizeof(EPICSVERSION)-1 || strncmp(field[2], EPICSVERSION, len[2]) != 0 ||
+                   len[3] != sizeof(T_A)-1 || strncmp(field[3], T_A, len[3]) != 0) {
+                        continue;
+                }
+                if(version) {
+                        if((size_t)len[1] == strlen(version) && strncmp(field[1], version, len[1]) == 0) {
+                                *contents = index_contents(field[4], len[4]);
+                                return 1;
+                        }
+                        continue;
+                }
+                /* Longer than any numbered version require can parse */
+                if(len[1] >= (int)sizeof(name)) {
+                        continue;
+                }
+                snprintf(name, sizeof(name), "%.*s", len[1], field[1]);
+                {
+                        int tmp;
+                        char ch;
+                        if(sscanf(name, "%d.%d.%d%c", &tmp, &tmp, &tmp, &ch) != 3) {
+                                continue;
+                        }
+                }
+                if(!(v = add_version(list))) {
+                        return -1;
+                }
+                ver_conv(name, &v->version);
+                v->contents = index_contents(field[4], len[4]);
+                debug_print("Indexed (%s).\n", name);
+                ++vers_c;
+        }
+        return vers_c;
+}
+
+/*
+ * Copy the next directory of a PATHSEP separated list like EPICS_MODULES_PATH
+ * to root and advance *list past it. Empty elements are skipped. Returns 0 at
+ * the end of the list.
+ */
+static int next_root(const char **list, char *root, size_t size) {
+        const char *p = *list;
+        size_t len;
+
+        while(p && *p == PATHSEP[0]) p++;
+        if(!p || *p == '\0') {
+                return 0;
+        }
+        len = strcspn(p, PATHSEP);
+        snprintf(root, size, "%.*s", (int)len, p);
+        *list = p + len;
+        return 1;
+}
+
+/*
+ * Find all installed numbered versions of module which are available on this
+ * platform and append them to list. Uses the module index if possible and
+ * scans the module directory otherwise. Returns the number of versions found
+ * or -1 if out of memory.
+ */
+static int find_versions(const char *epicsmodules, const char *module, struct version_list *list) {
+        char tmp_str[256];
+        DIR *dir;
+        struct dirent* ent;
+        struct installed_version *v;
+        struct probe *probes = NULL;
+        int nprobes = 0, probessize = 0;
+        int vers_c = 0;
+        int i;
+        struct module_index *idx = index_open(epicsmodules);
+
+        switch(index_usable(idx, epicsmodules, module)) {
+        case 0:
+                debug_print("%s is not installed in %s.\n", module, epicsmodules);
+                return 0;
+        case 1:
+                return index_versions(idx, module, NULL, list, NULL);
+        }
+
+        snprintf(tmp_str, sizeof(tmp_str), "%s" DIRSEP "%s", epicsmodules, module);
+        if(!(dir = opendir(tmp_str))) {
+                debug_print("Failed to open %s.\n", tmp_str);
+                return 0;
+        }
+        debug_print("Looking for versions in %s.\n", tmp_str);
+        /* Collect the candidates first and check them all at once */
+        while((ent = readdir(dir))){
+                struct probe *p;
+                int tmp, n;
+                char ch;
+                if(sscanf(ent->d_name, "%d.%d.%d%c", &tmp, &tmp, &tmp, &ch) != 3) {
+                        continue;
+                }
+                if(!(p = grow(probes, &probessize, nprobes, sizeof(struct probe)))) {
+                        closedir(dir);
+                        free(probes);
+                        return -1;
+                }
+                probes = p;
+                n = snprintf(probes[nprobes].path, sizeof(probes->path),
+                        "%s" DIRSEP "%s" DIRSEP "%s" DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A DIRSEP "%s.dep",
+                        epicsmodules, module, ent->d_name, module);
+                if(n < 0 || (size_t)n >= sizeof(probes->path)) {
+                        fprintf(stderr, "require: Path of %s %s in %s is too long.\n", module, ent->d_name, epicsmodules);
+                        continue;
+                }
+                nprobes++;
+        }
+        closedir(dir);
+        probe_paths(probes, nprobes);
+        for(i = 0; i < nprobes; i++) {
+                char *version = probes[i].path + strlen(epicsmodules) + strlen(module) + 2;
+                char *end = strchr(version, DIRSEP[0]);
+                if(end) *end = '\0';
+                if(!probes[i].found) {
+                        debug_print("Found (%s), not available on this platform.\n", version);
+                        continue;
+                }
+                if(!(v = add_version(list))) {
+                        free(probes);
+                        return -1;
+                }
+                ver_conv(version, &v->version);
+                v->contents = CONTENTS_UNKNOWN;
+                debug_print("Found (%d.%d.%d).\n", v->version.major, v->version.minor, v->version.patch);
+                ++vers_c;
+        }
+        free(probes);
+        return vers_c;
+}
+
+/*
+ * Check if a named version of module is installed on this platform.
+ */
+static int find_named_version(const char *epicsmodules, const char *module, const char *version, int *contents) {
+        char tmp_str[256];
+        struct module_index *idx = index_open(epicsmodules);
+
+        switch(index_usable(idx, epicsmodules, module)) {
+        case 0:
+                return 0;
+        case 1:
+                return index_versions(idx, module, version, NULL, contents);
+        }
+        *contents = CONTENTS_UNKNOWN;
+        if((size_t)snprintf(tmp_str, sizeof(tmp_str), "%s" DIRSEP "%s" DIRSEP "%s", epicsmodules, module, version) >= sizeof(tmp_str)) {
+                fprintf(stderr, "require: Path of %s %s in %s is too long.\n", module, version, epicsmodules);
+                return 0;
+        }
+        return arch_installed(module, tmp_str);
+}
+
+/*
+ * A module selected for loading.
+ */
+struct resolved_module {
+        char name[100];
+        char version[20];
+        char path[256];  /* Module directory, or library file of a system library */
+        int contents;    /* Parts provided by the module, see CONTENTS_* */
+        int system;      /* System library found in EPICS_MODULE_INCLUDE_PATH */
+        char *deps;      /* Dependencies, "module[,version]" separated by spaces */
+        double times[PHASES]; /* Seconds spent in each phase */
+};
+
+/*
+ * A version of a module requested by the user or by a dependency file.
+ */
+struct requirement {
+        char module[100];
+        char version[20];
+        char by[100];    /* Requiring module, empty if requested by the user */
+};
+
+/*
+ * The dependency graph of one require call. All dependency files are read
+ * and one version is chosen for every module before anything is loaded, so
+ * that a conflict anywhere in the graph is found without side effects.
+ */
+struct resolution {
+        struct resolved_module *modules; /* In the order they were found */
+        int nmodules;
+        int modulessize;
+        int *order;                      /* Indices into modules in load order */
+        int ordersize;
+        int norder;
+        struct requirement *reqs;        /* All requirements seen so far */
+        int nreqs;
+        int reqssize;
+        struct requirement *pins;        /* Versions chosen after a conflict */
+        int npins;
+        int pinssize;
+};
+
+/* Returned by resolve_module() if the resolution has to be restarted. */
+#define RESOLVE_RETRY 1
+/* Maximum number of restarts because of conflicting requirements. */
+#define MAX_RESOLVE_RETRIES 20
+
+/*
+ * Make room for one more element in a growing array.
+ */
+static void *grow(void *array, int *size, int count, size_t elemsize) {
+        void *p;
+        if(count < *size) {
+                return array;
+        }
+        p = realloc(array, (*size ? *size * 2 : 16) * elemsize);
+        if(!p) {
+                fprintf(stderr, "require: out of memory.\n");
+                return NULL;
+        }
+        *size = *size ? *size * 2 : 16;
+        return p;
+}
+
+static int add_requirement(struct requirement **reqs, int *n, int *size,
+                           const char *module, const char *version, const char *by) {
+        struct requirement *r;
+        if(strlen(module) >= sizeof(r->module)) {
+                fprintf(stderr, "require: Module name %s is too long.\n", module);
+                return -1;
+        }
+        if(version && strlen(version) >= sizeof(r->version)) {
+                fprintf(stderr, "require: Version %s of %s is too long.\n", version, module);
+                return -1;
+        }
+        if(!(r = grow(*reqs, size, *n, sizeof(struct requirement)))) {
+                return -1;
+        }
+        *reqs = r;
+        r += (*n)++;
+        memset(r, 0, sizeof(*r));
+        strcpy(r->module, module);
+        if(version) strcpy(r->version, version);
+        if(by) strncat(r->by, by, sizeof(r->by) - 1);
+        return 0;
+}
+
+static const char *find_pin(struct resolution *res, const char *module) {
+        int i;
+        for(i = 0; i < res->npins; i++) {
+                if(strcmp(res->pins[i].module, module) == 0) {
+                        return res->pins[i].version;
+                }
+        }
+        return NULL;
+}
+
+static int find_resolved(struct resolution *res, const char *module) {
+        int i;
+        for(i = 0; i < res->nmodules; i++) {
+                if(strcmp(res->modules[i].name, module) == 0) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
+/*
+ * Modules read from a lockfile by requireFromLock(). A locked module is used
+ * without any search as long as the locked version satisfies the request and
+ * its files still exist.
+ */
+static struct resolved_module *lockedModules = NULL;
+static int nlocked = 0;
+
+static const struct resolved_module *find_locked(const char *module, const char *version) {
+        const struct resolved_module *m;
+        struct stat filestat;
+        char filename[256];
+        int i;
+
+        for(i = 0; i < nlocked; i++) {
+                if(strcmp(lockedModules[i].name, module) == 0) break;
+        }
+        if(i == nlocked) {
+                return NULL;
+        }
+        m = &lockedModules[i];
+        if(validate(module, version, m->version) != 0) {
+                debug_print("Locked %s %s does not match requested version %s.\n", module, m->version, version);
+                return NULL;
+        }
+        /* A single stat to check that the module has not vanished. */
+        if(m->system || !(m->contents & (CONTENTS_LIB | CONTENTS_DBD))) {
+                snprintf(filename, sizeof(filename), "%s", m->path);
+        } else if(part_path(filename, sizeof(filename), m->path, module,
+                            m->contents & CONTENTS_LIB ? CONTENTS_LIB : CONTENTS_DBD) != 0) {
+                return NULL;
+        }
+        if(stat(filename, &filestat) != 0) {
+                printf("require: Locked %s %s not found, searching again.\n", module, m->version);
+                return NULL;
+        }
+        debug_print("Using locked %s %s.\n", module, m->version);
+        return m;
+}
+
+/*
+ * Index of the local "modules" folder: which checkout in it provides which
+ * module on this platform, from the dependency files of the checkouts. It is
+ * read on first use and read again when the folder is a different one or
+ * its mtime changed, that is when checkouts were added or removed.
+ */
+struct local_module {
+        const char *name;
+        const char *path;   /* LOC_MODULES/<checkout>/BUILDDIR */
+        int seq;            /* Position in the listing, the first checkout wins */
+};
+
+static struct {
+        struct local_module *modules;
+        int count;
+        int size;
+        int scanned;
+        dev_t dev;
+        ino_t ino;
+        time_t mtime;
+} localModules;
+
+static int compare_local_modules(const void *a, const void *b) {
+        const struct local_module *ma = a, *mb = b;
+        int c = strcmp(ma->name, mb->name);
+        return c ? c : ma->seq - mb->seq;
+}
+
+static int compare_local_names(const void *a, const void *b) {
+        return strcmp(((const struct local_module *)a)->name, ((const struct local_module *)b)->name);
+}
+
+static void local_scan(void) {
+        char tmp_str[256];
+        DIR *dir, *libdir;
+        struct dirent *ent, *libent;
+        struct local_module *lm;
+        int seq = 0;
+        int i, n;
+
+        localModules.count = 0;
+        if(!(dir = opendir(LOC_MODULES))) {
+                return;
+        }
+        debug_print("%s","Looking for modules in \"" LOC_MODULES "\".\n");
+        while((ent = readdir(dir))) {
+                if(ent->d_name[0] == '.') continue;
+                /* The path of the checkout is a prefix of its lib folder and fits if that does */
+                if((size_t)snprintf(tmp_str, sizeof(tmp_str), LOC_MODULES DIRSEP "%s" DIRSEP BUILDDIR DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A,
+                                    ent->d_name) >= sizeof(tmp_str)) {
+                        fprintf(stderr, "require: Path of " LOC_MODULES DIRSEP "%s is too long.\n", ent->d_name);
+                        continue;
+                }
+                if(!(libdir = opendir(tmp_str))) continue;
+                tmp_str[strlen(LOC_MODULES DIRSEP DIRSEP BUILDDIR) + strlen(ent->d_name)] = '\0';
+                while((libent = readdir(libdir))) {
+                        size_t len = strlen(libent->d_name);
+                        char name[100];
+                        if(len <= 4 || len - 4 >= sizeof(name) || strcmp(libent->d_name + len - 4, ".dep") != 0) continue;
+                        if(!(lm = grow(localModules.modules, &localModules.size, localModules.count, sizeof(struct local_module)))) {
+                                break;
+                        }
+                        localModules.modules = lm;
+                        memcpy(name, libent->d_name, len - 4);
+                        name[len - 4] = '\0';
+                        lm = &localModules.modules[localModules.count];
+                        if(!(lm->name = intern(name)) || !(lm->path = intern(tmp_str))) {
+                                break;
+                        }
+                        lm->seq = seq++;
+                        localModules.count++;
+                }
+                closedir(libdir);
+        }
+        closedir(dir);
+        /* Keep only the first checkout providing a module */
+        qsort(localModules.modules, localModules.count, sizeof(struct local_module), compare_local_modules);
+        for(i = 0, n = 0; i < localModules.count; i++) {
+                if(n == 0 || strcmp(localModules.modules[n-1].name, localModules.modules[i].name) != 0) {
+                        localModules.modules[n++] = localModules.modules[i];
+                }
+        }
+        localModules.count = n;
+        debug_print("Found %d local modules.\n", n);
+}
+
+/*
+ * Find the checkout in the local "modules" folder which provides module.
+ * Returns its build directory or NULL.
+ */
+static const char *find_local(const char *module) {
+        struct stat filestat;
+        struct local_module key, *lm;
+
+        if(stat(LOC_MODULES, &filestat) != 0) {
+                localModules.scanned = 0;
+                return NULL;
+        }
+        if(!localModules.scanned || filestat.st_mtime != localModules.mtime ||
+           filestat.st_dev != localModules.dev || filestat.st_ino != localModules.ino) {
+                local_scan();
+                localModules.scanned = 1;
+                localModules.dev = filestat.st_dev;
+                localModules.ino = filestat.st_ino;
+                localModules.mtime = filestat.st_mtime;
+        }
+        key.name = module;
+        key.seq = -1;
+        lm = bsearch(&key, localModules.modules, localModules.count, sizeof(struct local_module), compare_local_names);
+        return lm ? lm->path : NULL;
+}
+
+#if defined (__linux__)
+#include <stdint.h>
+
+/*
+ * The cache of the dynamic loader, written by ldconfig. It lists the
+ * libraries in the system library directories, so system libraries in these
+ * directories are found without looking at the directories. It is read again
+ * when ldconfig has written a new one. Only the format of glibc 2.32 and
+ * newer and the combined format written before are read.
+ */
+#define LDSOCACHE "/etc/ld.so.cache"
+#define LDSOCACHEOLD "ld.so-1.7.0"
+#define LDSOCACHENEW "glibc-ld.so.cache1.1"
+
+struct ldso_entry {
+        int32_t flags;
+        uint32_t key;       /* File name */
+        uint32_t value;     /* Path */
+        uint32_t osversion;
+        uint64_t hwcap;
+};
+
+static struct {
+        int state;          /* 0: not read, 1: usable, -1: not usable */
+        const char *data;   /* The mapped file */
+        size_t datasize;
+        dev_t dev;
+        ino_t ino;
+        time_t mtime;
+        const char *strings;
+        size_t stringssize;
+        const struct ldso_entry *entries;
+        uint32_t count;
+        uint32_t *byname;   /* Entries sorted by file name */
+} ldsoCache;
+
+static const char *ldso_string(uint32_t offset)
+{
+        if (offset >= ldsoCache.stringssize || !memchr(ldsoCache.strings + offset, 0, ldsoCache.stringssize - offset)) {
+                return "";
+        }
+        return ldsoCache.strings + offset;
+}
+
+static int compare_ldso_names(const void *a, const void *b)
+{
+        return strcmp(ldso_string(ldsoCache.entries[*(const uint32_t *)a].key),
+                ldso_string(ldsoCache.entries[*(const uint32_t *)b].key));
+}
+
+static void ldso_close(void)
+{
+        if (ldsoCache.data) {
+                munmap((void *)ldsoCache.data, ldsoCache.datasize);
+        }
+        free(ldsoCache.byname);
+        memset(&ldsoCache, 0, sizeof(ldsoCache));
+}
+
+static int ldso_open(void)
+{
+        struct stat filestat;
+        const char *data, *p;
+        uint32_t nlibs, i;
+        int fd;
+
+        if (ldsoCache.state != 0) {
+                return ldsoCache.state;
+        }
+        ldsoCache.state = -1;
+        if ((fd = open(LDSOCACHE, O_RDONLY)) < 0) {
+                return -1;
+        }
+        if (fstat(fd, &filestat) != 0) {
+                close(fd);
+                return -1;
+        }
+        /* Remember the file also if it is not usable, to notice a new one */
+        ldsoCache.dev = filestat.st_dev;
+        ldsoCache.ino = filestat.st_ino;
+        ldsoCache.mtime = filestat.st_mtime;
+        ldsoCache.datasize = filestat.st_size;
+        if (filestat.st_size < 48 ||
+            (data = mmap(NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+                close(fd);
+                return -1;
+        }
+        close(fd);
+        ldsoCache.data = p = data;
+        if (memcmp(p, LDSOCACHEOLD, sizeof(LDSOCACHEOLD) - 1) == 0) {
+                /* The new format follows the old one, aligned */
+                memcpy(&nlibs, p + 12, sizeof(nlibs));
+                p += ((16 + (size_t)nlibs * 12) + 7) & ~(size_t)7;
+        }
+        if (p + 48 > data + filestat.st_size || memcmp(p, LDSOCACHENEW, sizeof(LDSOCACHENEW) - 1) != 0) {
+                debug_print("%s has an unknown format.\n", LDSOCACHE);
+                return -1;
+        }
+        memcpy(&ldsoCache.count, p + 20, sizeof(ldsoCache.count));
+        if (p + 48 + (size_t)ldsoCache.count * sizeof(struct ldso_entry) > data + filestat.st_size ||
+            !(ldsoCache.byname = malloc(ldsoCache.count * sizeof(uint32_t) + 1))) {
+                ldsoCache.count = 0;
+                return -1;
+        }
+        /* String offsets are relative to the new header */
+        ldsoCache.entries = (const struct ldso_entry *)(p + 48);
+        ldsoCache.strings = p;
+        ldsoCache.stringssize = data + filestat.st_size - p;
+        for (i = 0; i < ldsoCache.count; i++) {
+                ldsoCache.byname[i] = i;
+        }
+        qsort(ldsoCache.byname, ldsoCache.count, sizeof(uint32_t), compare_ldso_names);
+        debug_print("%s lists %u libraries.\n", LDSOCACHE, (unsigned)ldsoCache.count);
+        return ldsoCache.state = 1;
+}
+
+/*
+ * Drop the loader cache if ldconfig has written a new one since it was read.
+ * Returns 1 if it was dropped.
+ */
+static int ldso_changed(void)
+{
+        struct stat filestat;
+
+        if (ldsoCache.state == 0) {
+                return 0;
+        }
+        if (stat(LDSOCACHE, &filestat) == 0 ? filestat.st_dev == ldsoCache.dev && filestat.st_ino == ldsoCache.ino &&
+            filestat.st_mtime == ldsoCache.mtime && (size_t)filestat.st_size == ldsoCache.datasize : !ldsoCache.data) {
+                return 0;
+        }
+        debug_print("%s has changed.\n", LDSOCACHE);
+        ldso_close();
+        return 1;
+}
+
+/*
+ * Look up the library name in the directory dir with the loader cache. Also
+ * accepts a versioned name like name.1, which is what the loader uses.
+ * Returns 1 and the path of the library if found and 0 if not. The library
+ * may still be in dir if it was installed after ldconfig ran.
+ */
+static int ldso_find(const char *dir, const char *name, char *path, size_t size)
+{
+        size_t dirlen = strlen(dir), namelen = strlen(name);
+        uint32_t low = 0, high, i;
+        int found = 0;
+
+        if (ldso_open() != 1) {
+                return 0;
+        }
+        while (dirlen > 1 && dir[dirlen-1] == '/') dirlen--;
+        /* The first entry not below name, the versioned names follow it */
+        high = ldsoCache.count;
+        while (low < high) {
+                uint32_t mid = low + (high - low) / 2;
+                if (strcmp(ldso_string(ldsoCache.entries[ldsoCache.byname[mid]].key), name) < 0) low = mid + 1;
+                else high = mid;
+        }
+        for (i = low; i < ldsoCache.count; i++) {
+                const struct ldso_entry *e = &ldsoCache.entries[ldsoCache.byname[i]];
+                const char *key = ldso_string(e->key);
+                const char *value;
+                if (strncmp(key, name, namelen) != 0) {
+                        break;
+                }
+                if (key[namelen] != '\0' && key[namelen] != '.') {
+                        continue;
+                }
+                value = ldso_string(e->value);
+                if (strncmp(value, dir, dirlen) != 0 || value[dirlen] != '/' || strchr(value + dirlen + 1, '/')) {
+                        continue;
+                }
+                /* Prefer the unversioned name, it is what the directory walk finds */
+                if (!found || key[namelen] == '\0') {
+                        snprintf(path, size, "%s", value);
+                        found = 1;
+                        if (key[namelen] == '\0') break;
+                }
+        }
+        return found;
+}
+#else
+static int ldso_changed(void)
+{
+        return 0;
+}
+
+static int ldso_find(const char *dir, const char *name, char *path, size_t size)
+{
+        return 0;
+}
+#endif
+
+/*
+ * System libraries not found in EPICS_MODULE_INCLUDE_PATH, as interned
+ * "<library>:<path>" strings, so that asking again costs no file system
+ * access.
+ */
+static struct {
+        const char **missing;
+        int count;
+        int size;
+} systemLibraries;
+
+/*
+ * Find the system library syslibname in the directories of module_incpath.
+ * If the loader cache has the library in one of them, only the directories
+ * in front of that one are looked at, else all of them, as libraries may
+ * have been installed after ldconfig ran. Returns 0 and the path of the
+ * library if found.
+ */
+static int find_system_library(const char *module_incpath, const char *syslibname, char *path, size_t size)
+{
+        const char sep[1] = PATHSEP;
+        struct stat filestat;
+        const char *p, *end;
+        const char *key;
+        const char **missing;
+        char libdir[256];
+        char cached[256];
+        char buffer[512];
+        size_t len;
+        int i;
+
+        if (ldso_changed()) {
+                /* ldconfig ran, maybe for newly installed libraries */
+                systemLibraries.count = 0;
+        }
+        snprintf(buffer, sizeof(buffer), "%s:%s", syslibname, module_incpath);
+        key = intern(buffer);
+        for (i = 0; key && i < systemLibraries.count; i++) {
+                if (systemLibraries.missing[i] == key) {
+                        debug_print("%s is known to be missing.\n", syslibname);
+                        return -1;
+                }
+        }
+
+        /* First the directory where the loader cache has the library */
+        cached[0] = '\0';
+        for (p = module_incpath; p != NULL; p = end) {
+                end = strchr(p, sep[0]);
+                snprintf (libdir, sizeof(libdir), "%.*s", end ? (int)(end-p) : (int)strlen(p), p);
+                if (end) end++;
+                if (libdir[0] != 0 && ldso_find(libdir, syslibname, cached, sizeof(cached)) == 1) {
+                        debug_print("%s found in the loader cache.\n", cached);
+                        break;
+                }
+        }
+
+        /* Then the directories in front of it the cache does not know */
+        for (p = module_incpath; p != NULL; p = end) {
+                end = strchr(p, sep[0]);
+                if (end) {
+                        snprintf (libdir, sizeof(libdir), "%.*s", (int)(end-p), p);
+                        end++;
+                } else {
+                        snprintf (libdir, sizeof(libdir), "%s", p);
+                }
+                /* ignore empty module_incpath elements */
+                if (libdir[0] == 0) continue;
+
+                len = strlen(libdir);
+                while (len > 1 && libdir[len-1] == DIRSEP[0]) len--;
+                if (cached[0] && strncmp(cached, libdir, len) == 0 &&
+                    cached[len] == DIRSEP[0] && !strchr(cached + len + 1, DIRSEP[0])) {
+                        snprintf (path, size, "%s", cached);
+                        return 0;
+                }
+                if ((size_t)snprintf (path, size, "%s" DIRSEP "%s", libdir, syslibname) >= size) {
+                        fprintf(stderr, "require: Path of %s in %s is too long.\n", syslibname, libdir);
+                        continue;
+                }
+                debug_print("looking for %s.\n", path);
+                if (stat(path, &filestat) == 0) return 0;
+#ifdef vxWorks
+                /* now without the .munch */
+                path[strlen(path)-6] = 0;
+                debug_print("looking for %s.\n", path);
+                if (stat(path, &filestat) == 0) return 0;
+#endif
+        }
+        debug_print("require: \"%s\" not found in %s.\n", syslibname, module_incpath);
+        path[0] = '\0';
+        if (key && (missing = grow(systemLibraries.missing, &systemLibraries.size, systemLibraries.count, sizeof(const char *)))) {
+                systemLibraries.missing = missing;
+                systemLibraries.missing[systemLibraries.count++] = key;
+        }
+        return -1;
+}
+
+/*
+ * Find module in EPICS_MODULES_PATH, in the local "modules" folder or as a
+ * system library in EPICS_MODULE_INCLUDE_PATH. Fills in m and returns 0 if
+ * the module was found.
+ */
+static int find_module(const char *epicsmodules, const char *module_incpath,
+                       const char *module, const char *vers, struct resolved_module *m) {
+        const int size = sizeof(m->path);
+        char version[20];
+        struct version_range range;
+        char tmp_str[256];
+        char root[256];
+        const char *roots;
+        int tmp;
+        char ch;
+        char *epicsbase;
+
+        memset(m, 0, sizeof(*m));
+        strncat(m->name, module, sizeof(m->name) - 1);
+        m->contents = CONTENTS_UNKNOWN;
+        memset(version, 0, sizeof(version));
+        if (vers && strlen(vers) >= sizeof(version)) {
+                fprintf(stderr, "require: Version %s of %s is too long.\n", vers, module);
+                return -1;
+        }
+        if (vers) strcpy(version, vers);
+
+        /*
+         * Check if any module in the current dir implements this module.
+         */
+        if(version[0] == '\0' || strcmp(version, "local") == 0) {
+                const char *local = find_local(module);
+                if(local) {
+                        strcpy(version, "local");
+                        snprintf(m->path, size, "%s", local);
+                        debug_print("Found (local) in %s.\n", local);
+                }
+        }
+
+        /*
+         * If user requested a named (and not numbered) version, try to find it.
+         */
+        if(m->path[0] == '\0' && version[0] != '\0' && sscanf(version, "%d.%d.%d%c", &tmp, &tmp, &tmp, &ch) != 3) {
+                for(roots = epicsmodules; next_root(&roots, root, sizeof(root)); ) {
+                        if(find_named_version(root, module, version, &m->contents)) {
+                                if((size_t)snprintf(m->path, size, "%s" DIRSEP "%s" DIRSEP "%s", root, module, version) >= size) {
+                                        fprintf(stderr, "require: Path of %s %s in %s is too long.\n", module, version, root);
+                                        return -1;
+                                }
+                                debug_print("Found named version (%s) in %s.\n", version, root);
+                                break;
+                        }
+                }
+        }
+
+        /*
+         * If user didn't request a specific version, look in dependency files.
+         */
+        epicsbase = getenv("EPICS_BASE");
+        if (version[0] == '\0' && epicsbase)
+        {
+                snprintf(tmp_str, sizeof(tmp_str), "%s" DIRSEP "configure" DIRSEP "default." T_A ".dep", epicsbase);
+                int found = find_default(module, tmp_str, version);
+                if (!found) {
+                        snprintf(tmp_str, sizeof(tmp_str), "%s" DIRSEP "configure" DIRSEP "default.dep", epicsbase);
+                        found = find_default(module, tmp_str, version);
+                }
+        } else if (!epicsbase) {
+                debug_print("%s","EPICS_BASE not defined.\n");
+        }
+
+        if(compile_version(version, &range) != 0) {
+                fprintf(stderr, "require: Invalid version %s of %s requested.\n", version, module);
+                return -1;
+        }
+        debug_print("Version (%s) from (%d,%d,%d) below (%d,%d,%d).\n", version,
+                    range.low.major, range.low.minor, range.low.patch,
+                    range.high.major, range.high.minor, range.high.patch);
+
+        /*
+         * If there still isn't a candidate, find all installed versions of the
+         * module, sort them and pick the highest valid version. The first root
+         * in EPICS_MODULES_PATH with a valid version wins.
+         */
+        for(roots = epicsmodules; m->path[0] == '\0' && !range.name && next_root(&roots, root, sizeof(root)); ) {
+                struct version_list list = { NULL, 0, 0 };
+                if(find_versions(root, module, &list) < 0) {
+                        free(list.versions);
+                        return -1;
+                }
+                if(list.count > 0) {
+                        struct installed_version *v;
+                        int i;
+                        sort_versions(&list);
+                        if((i = highest_match(&list, &range)) >= 0) {
+                                v = &list.versions[i];
+                                sprintf(version, "%d.%d.%d", v->version.major, v->version.minor, v->version.patch);
+                                if((size_t)snprintf(m->path, size, "%s" DIRSEP "%s" DIRSEP "%s", root, module, version) >= size) {
+                                        fprintf(stderr, "require: Path of %s %s in %s is too long.\n", module, version, root);
+                                        free(list.versions);
+                                        return -1;
+                                }
+                                m->contents = v->contents;
+                                debug_print("Chosen (%s) in %s.\n", version, root);
+                        }
+                }
+                free(list.versions);
+        }
+
+        if(m->path[0] != '\0') {
+                strcpy(m->version, version);
+                return 0;
+        }
+
+        debug_print("Could not find an EPICS module named \"%s\". Looking for "
+                    "system libraries.\n", module);
+        /* Might be a system library. Search for library in
+         * module_incpath. */
+        {
+                char syslibname[256];
+                snprintf(syslibname, sizeof(syslibname), PREFIX "%s" INFIX EXT, module);
+                if (find_system_library(module_incpath, syslibname, m->path, size) != 0) {
+                        return -1;
+                }
+        }
+        strcpy(m->version, "system");
+        m->system = 1;
+        return 0;
+}
+
+/*
+ * A module was required in a version which does not validate against the
+ * version already chosen for it. Try to find one installed version which
+ * satisfies every requirement on the module and restart the resolution with
+ * that version. Returns RESOLVE_RETRY on success and -1 if there is no such
+ * version.
+ */
+static int resolve_conflict(struct resolution *res, const char *epicsmodules, const char *module) {
+        struct version_list list = { NULL, 0, 0 };
+        struct installed_version *inst_vers;
+        struct version_range range;
+        char version[20];
+        int i, j;
+
+        if(!find_pin(res, module)) {
+                char root[256];
+                const char *roots;
+                for(roots = epicsmodules; next_root(&roots, root, sizeof(root)); ) {
+                        if(find_versions(root, module, &list) < 0) {
+                                free(list.versions);
+                                return -1;
+                        }
+                }
+                sort_versions(&list);
+                inst_vers = list.versions;
+                for(i = list.count - 1; i >= 0; --i) {
+                        sprintf(version, "%d.%d.%d", inst_vers[i].version.major, inst_vers[i].version.minor, inst_vers[i].version.patch);
+                        for(j = 0; j < res->nreqs; j++) {
+                                if(strcmp(res->reqs[j].module, module) != 0) continue;
+                                if(res->reqs[j].version[0] == '\0') continue;
+                                if(compile_version(res->reqs[j].version, &range) != 0 ||
+                                   !version_in_range(&range, &inst_vers[i].version)) break;
+                        }
+                        if(j == res->nreqs) {
+                                printf("require: Choosing %s %s to satisfy all dependencies.\n", module, version);
+                                free(list.versions);
+                                if(add_requirement(&res->pins, &res->npins, &res->pinssize, module, version, NULL) != 0) {
+                                        return -1;
+                                }
+                                return RESOLVE_RETRY;
+                        }
+                }
+                free(list.versions);
+        }
+        fprintf(stderr, "require: Conflicting versions of %s requested:\n", module);
+        for(j = 0; j < res->nreqs; j++) {
+                if(strcmp(res->reqs[j].module, module) != 0) continue;
+                fprintf(stderr, "require:   %s requires %s %s\n", res->reqs[j].by[0] ? res->reqs[j].by : "user",
+                        module, res->reqs[j].version[0] ? res->reqs[j].version : "(any version)");
+        }
+        return -1;
+}
+
+static int resolve_module(struct resolution *res, const char *epicsmodules, const char *module_incpath,
+                          const char *module, const char *version, const char *by);
+
+/*
+ * Append "module[,version]" to a space separated list of dependencies.
+ */
+static int append_dep(char **deps, const char *module, const char *version) {
+        size_t len = *deps ? strlen(*deps) : 0;
+        char *p = realloc(*deps, len + strlen(module) + strlen(version) + 3);
+        if(!p) {
+                fprintf(stderr, "require: out of memory.\n");
+                return -1;
+        }
+        sprintf(p + len, "%s%s%s%s", len ? " " : "", module, version[0] ? "," : "", version);
+        *deps = p;
+        return 0;
+}
+
+static int resolve_dependency(struct resolution *res, const char *epicsmodules, const char *module_incpath,
+                              int i, char *rmodule, char *rversion) {
+        const char *module = res->modules[i].name;
+        if(rversion[0] == '\0') {
+                printf("require: %s depends on %s (no version).\n", module, rmodule);
+        } else {
+                printf("require: %s depends on %s (%s).\n", module, rmodule, rversion);
+        }
+        if(append_dep(&res->modules[i].deps, rmodule, rversion) != 0) {
+                return -1;
+        }
+        /*
+         * res->modules may move while resolving, so pass a copy of the name.
+         * The time spent on the dependency is not counted for this module.
+         */
+        {
+                char by[sizeof(res->modules[i].name)];
+                double start = monotonic();
+                int status;
+                strcpy(by, module);
+                status = resolve_module(res, epicsmodules, module_incpath, rmodule, rversion, by);
+                res->modules[i].times[PHASE_DEPS] -= monotonic() - start;
+                return status;
+        }
+}
+
+/*
+ * Add module and, recursively, everything it depends on to the resolution.
+ * Modules are appended to the load order after their dependencies.
+ */
+static int resolve_module(struct resolution *res, const char *epicsmodules, const char *module_incpath,
+                          const char *module, const char *version, const char *by) {
+        struct resolved_module m;
+        const struct resolved_module *locked;
+        const char *loaded;
+        const char *pinned;
+        char depname[256];
+        FILE* depfile;
+        char buffer[40];
+        char *rmodule; /* required module */
+        char *rversion; /* required version */
+        char *end;
+        int *order;
+        int i;
+        int status;
+        double start;
+
+        debug_print("checking module %s version %s.\n", module, version);
+        if(add_requirement(&res->reqs, &res->nreqs, &res->reqssize, module, version, by) != 0) {
+                return -1;
+        }
+
+        loaded = getLibVersion(module);
+        if (loaded)
+        {
+                debug_print("loaded version of %s is %s.\n",
+                        module, loaded);
+                /* Library already loaded. Check Version. */
+                if (validate(module, version, loaded) != 0)
+                {
+                        printf("Conflict between requested %s version %s\n"
+                                "and already loaded version %s.\n",
+                                module, version, loaded);
+                        return -1;
+                }
+                /* Loaded version is ok */
+                debug_print("%s %s already loaded.\n", module, loaded);
+                return 0;
+        }
+
+        if ((i = find_resolved(res, module)) >= 0)
+        {
+                if (validate(module, version, res->modules[i].version) != 0)
+                {
+                        return resolve_conflict(res, epicsmodules, module);
+                }
+                debug_print("%s %s already chosen.\n", module, res->modules[i].version);
+                return 0;
+        }
+
+        if ((pinned = find_pin(res, module)))
+        {
+                version = pinned;
+        }
+        start = monotonic();
+        if ((locked = find_locked(module, version)))
+        {
+                m = *locked;
+                m.deps = NULL;
+        }
+        else if (find_module(epicsmodules, module_incpath, module, version, &m) != 0)
+        {
+                return -1;
+        }
+        if (!(res->modules = grow(res->modules, &res->modulessize, res->nmodules, sizeof(m))))
+        {
+                return -1;
+        }
+        i = res->nmodules++;
+        res->modules[i] = m;
+        memset(res->modules[i].times, 0, sizeof(res->modules[i].times));
+        res->modules[i].times[PHASE_RESOLVE] = monotonic() - start;
+
+        start = monotonic();
+
+        if (locked)
+        {
+                /* Dependencies were recorded in the lockfile. */
+                char *deps = locked->deps ? strdup(locked->deps) : NULL;
+                char *next;
+                for (rmodule = deps; rmodule && *rmodule; rmodule = next)
+                {
+                        next = strchr(rmodule, ' ');
+                        if (next) *next++ = 0;
+                        rversion = strchr(rmodule, ',');
+                        if (rversion) *rversion++ = 0; else rversion = "";
+                        status = resolve_dependency(res, epicsmodules, module_incpath, i, rmodule, rversion);
+                        if (status != 0)
+                        {
+                                free(deps);
+                                return status;
+                        }
+                }
+                free(deps);
+        }
+        else if (!m.system)
+        {
+                if ((size_t)snprintf(depname, sizeof(depname), "%s" DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A DIRSEP "%s.dep",
+                                     m.path, module) >= sizeof(depname)) {
+                        fprintf(stderr, "require: Path of %s in %s is too long.\n", module, m.path);
+                        return -1;
+                }
+                debug_print("depname is %s.\n", depname);
+
+                /* parse dependency file and resolve required modules. */
+                if(!(depfile = fopen(depname, "r"))) {
+                        printf("Failed to open %s.\n", depname);
+                        return -1;
+                }
+                profile_add(depname);
+                while (fgets(buffer, sizeof(buffer)-1, depfile))
+                {
+                        rmodule = buffer;
+                        /* ignore leading spaces */
+                        while (isspace((int)*rmodule)) rmodule++;
+                        /* ignore empty lines and comment lines */
+                        if (*rmodule == 0 || *rmodule == '#') continue;
+                        /* rmodule at start of module name */
+                        rversion = rmodule;
+                        /* find end of module name */
+                        while (*rversion && *rversion != ',' && !isspace(*rversion)) rversion++;
+                        /* Finished if newline is reached */
+                        if(*rversion != '\n' && *rversion != '\0') {
+                                /* terminate module name */
+                                *rversion++ = 0;
+                                /* ignore spaces */
+                                while (isspace((int)*rversion)) rversion++;
+                                /* rversion at start of version */
+                                end = rversion;
+                                /* find end of version */
+                                while (*end && !isspace((int)*end)) end++;
+                                /* terminate version */
+                                *end = 0;
+                        } else {
+                                *rversion = 0;
+                        }
+                        status = resolve_dependency(res, epicsmodules, module_incpath, i, rmodule, rversion);
+                        if (status != 0)
+                        {
+                                fclose(depfile);
+                                return status;
+                        }
+                }
+                fclose(depfile);
+        }
+        res->modules[i].times[PHASE_DEPS] += monotonic() - start;
+
+        if (!(order = grow(res->order, &res->ordersize, res->norder, sizeof(int))))
+        {
+                return -1;
+        }
+        res->order = order;
+        res->order[res->norder++] = i;
+        return 0;
+}
+
+/*
+ * Pipelined loading. With requirePipeline set, a worker thread walks the
+ * load order ahead of the main thread, loads the libraries of the next
+ * modules and reads their dbd files into memory. The main thread still
+ * parses the dbd files and calls the register functions in order, it only
+ * waits if the worker has not prepared the next module yet.
+ */
+struct preload {
+        struct resolved_module *m;
+        HMODULE libhandle;   /* Library loaded ahead or NULL */
+        char *dbd;           /* Contents of the dbd file or NULL */
+        size_t dbdsize;
+        double times[PHASES]; /* Seconds the worker spent on m */
+        epicsEventId ready;  /* Signaled when the worker is done with m */
+};
+
+struct pipeline {
+        struct preload *items;
+        int count;
+        volatile int cancel; /* Main thread stopped loading */
+        epicsEventId done;   /* Signaled when the worker exits */
+};
+
+static char *read_file(const char *filename, size_t *size)
+{
+        struct stat filestat;
+        FILE *file;
+        char *buffer;
+
+        if (stat(filename, &filestat) != 0 || filestat.st_size == 0) {
+                return NULL;
+        }
+        if (!(file = fopen(filename, "rb"))) {
+                return NULL;
+        }
+        if ((buffer = malloc(filestat.st_size))) {
+                *size = fread(buffer, 1, filestat.st_size, file);
+                if (*size == 0) {
+                        free(buffer);
+                        buffer = NULL;
+                }
+        }
+        fclose(file);
+        return buffer;
+}
+
+static void preload_worker(void *arg)
+{
+        struct pipeline *pl = arg;
+        char filename[256];
+        int i;
+
+        for (i = 0; i < pl->count && !pl->cancel; i++) {
+                struct preload *pre = &pl->items[i];
+                struct resolved_module *m = pre->m;
+
+                /* System libraries are found by loadlib() */
+                if (!m->system) {
+                        double start;
+                        trace_begin("preload", m->name);
+#if defined (__unix__)
+                        /*
+                         * The libraries are loaded in load order, so the
+                         * symbols of the dependencies are already there.
+                         * Loaded libraries are never unloaded, the main
+                         * thread gets the same handle from loadlib().
+                         * With the deferred policy the main thread decides
+                         * if the library is loaded at all.
+                         */
+                        start = monotonic();
+                        if (part_path(filename, sizeof(filename), m->path, m->name, CONTENTS_LIB) == 0 &&
+                            load_policy() != LOAD_DEFERRED &&
+                            module_has(m->contents, CONTENTS_LIB, filename)) {
+                                pre->libhandle = dlopen(filename, (load_policy() == LOAD_NOW ? RTLD_NOW : RTLD_LAZY)|RTLD_GLOBAL);
+                        }
+                        pre->times[PHASE_LIB] = monotonic() - start;
+#endif
+                        start = monotonic();
+                        if (part_path(filename, sizeof(filename), m->path, m->name, CONTENTS_DBD) == 0 &&
+                            module_has(m->contents, CONTENTS_DBD, filename)) {
+                                pre->dbd = read_file(filename, &pre->dbdsize);
+                        }
+                        pre->times[PHASE_DBD] = monotonic() - start;
+                        trace_end();
+                }
+                epicsEventSignal(pre->ready);
+        }
+        epicsEventSignal(pl->done);
+}
+
+#if defined (__unix__)
+/*
+ * Cache of module dbd files. Module dbd files are expanded, but they repeat
+ * the menus and record types of EPICS base and of other modules, which
+ * dbLoadDatabase() parses again only to drop them as duplicates. The cache
+ * holds the top level definitions of a dbd file split by kind and name, so
+ * that only the definitions which are not in pdbbase yet are parsed.
+ *
+ * The cache file starts with DBDCACHEHEADER and a line with size, mtime and
+ * path of the dbd file, followed by the definitions, each one a line
+ *   <kind> <name> <length>
+ * and length bytes of dbd text. The cache is only kept if REQUIRE_CACHE_DIR
+ * is set, never in the module tree, which is often shared and read-only.
+ * Without it the dbd file is split each time. The cache is ignored and
+ * rewritten if it does not match the dbd file, and the dbd file is parsed as
+ * a whole if it can't be split, e.g. because it includes other files.
+ */
+#define DBDCACHEHEADER "# require dbd cache 1 " EPICSVERSION "\n"
+#define DBDCACHEEXT ".cache"
+
+struct dbd_definition {
+        const char *kind;
+        int kindlen;
+        const char *name;
+        int namelen;
+        const char *text;
+        size_t len;
+};
+
+struct dbd_definitions {
+        struct dbd_definition *defs;
+        int count;
+        int size;
+};
+
+/* Skip a quoted string starting at p */
+static const char *dbd_skip_string(const char *p, const char *end)
+{
+        for (p++; p < end && *p != '"'; p++) {
+                if (*p == '\\' && p + 1 < end) p++;
+        }
+        return p < end ? p + 1 : end;
+}
+
+/* Skip to the start of the next line */
+static const char *dbd_skip_line(const char *p, const char *end)
+{
+        while (p < end && *p != '\n') p++;
+        return p < end ? p + 1 : end;
+}
+
+/*
+ * Split dbd text into its top level definitions. Returns -1 if the text
+ * can't be split.
+ */
+static int dbd_split(const char *text, size_t size, struct dbd_definitions *list)
+{
+        const char *p = text;
+        const char *end = text + size;
+        struct dbd_definition *def;
+
+        while (p < end) {
+                const char *start;
+                int depth;
+
+                if (isspace((unsigned char)*p)) {
+                        p++;
+                        continue;
+                }
+                /* Comments, and code lines which are only used to generate headers */
+                if (*p == '#' || *p == '%') {
+                        p = dbd_skip_line(p, end);
+                        continue;
+                }
+                if (!(def = grow(list->defs, &list->size, list->count, sizeof(struct dbd_definition)))) {
+                        return -1;
+                }
+                list->defs = def;
+                def = &list->defs[list->count];
+                start = p;
+                def->kind = p;
+                while (p < end && isalpha((unsigned char)*p)) p++;
+                def->kindlen = p - def->kind;
+                while (p < end && isspace((unsigned char)*p)) p++;
+                /* include, path and addpath have no parentheses */
+                if (def->kindlen == 0 || p >= end || *p != '(') {
+                        debug_print("Can't split dbd file at \"%.*s\".\n", (int)(p - start + 1), start);
+                        return -1;
+                }
+                /* The name is the first argument */
+                for (p++; p < end && isspace((unsigned char)*p); p++);
+                if (p < end && *p == '"') p++;
+                def->name = p;
+                while (p < end && *p != ',' && *p != ')' && *p != '"' && !isspace((unsigned char)*p)) p++;
+                def->namelen = p - def->name;
+                while (p < end && *p != ')') {
+                        p = *p == '"' ? dbd_skip_string(p, end) : p + 1;
+                }
+                if (p >= end) return -1;
+                def->len = ++p - start;
+                while (p < end && isspace((unsigned char)*p)) p++;
+                if (p < end && *p == '{') {
+                        for (depth = 0; p < end; ) {
+                                if (*p == '"') {
+                                        p = dbd_skip_string(p, end);
+                                        continue;
+                                }
+                                if (*p == '#' || (*p == '%' && (p[-1] == '\n' || p[-1] == ' ' || p[-1] == '\t'))) {
+                                        p = dbd_skip_line(p, end);
+                                        continue;
+                                }
+                                if (*p == '{') depth++;
+                                if (*p++ == '}' && --depth == 0) break;
+                        }
+                        if (depth != 0) return -1;
+                        def->len = p - start;
+                }
+                def->text = start;
+                p = start + def->len;
+                list->count++;
+        }
+        return 0;
+}
+
+/*
+ * Check if a definition is already in pdbbase and would be dropped as a
+ * duplicate anyway.
+ */
+static int dbd_defined(const struct dbd_definition *def)
+{
+        char name[256];
+        int found = 0;
+
+        if (!pdbbase || def->namelen >= (int)sizeof(name)) {
+                return 0;
+        }
+        sprintf(name, "%.*s", def->namelen, def->name);
+        if (def->kindlen == 4 && strncmp(def->kind, "menu", 4) == 0) {
+                found = dbFindMenu(pdbbase, name) != NULL;
+        } else if (def->kindlen == 10 && strncmp(def->kind, "recordtype", 10) == 0) {
+                DBENTRY dbentry;
+                dbInitEntry(pdbbase, &dbentry);
+                found = dbFindRecordType(&dbentry, name) == 0;
+                dbFinishEntry(&dbentry);
+        }
+        return found;
+}
+
+/*
+ * Name of the cache file of dbdname. Returns 0 if there is no cache.
+ */
+static int dbd_cache_name(char *buffer, size_t size, const char *dbdname)
+{
+        const char *cachedir = getenv("REQUIRE_CACHE_DIR");
+        const char *base = strrchr(dbdname, DIRSEP[0]);
+
+        if (!cachedir || !cachedir[0]) {
+                return 0;
+        }
+        /* The hash tells apart the dbd files of different versions */
+        if ((size_t)snprintf(buffer, size, "%s" DIRSEP "%08x-%s" DBDCACHEEXT, cachedir,
+                             hash_string(dbdname), base ? base + 1 : dbdname) >= size) {
+                debug_print("Cache name of %s is too long.\n", dbdname);
+                return 0;
+        }
+        return 1;
+}
+
+/*
+ * Read the cache file and split it into definitions. Returns the contents
+ * of the cache file, which the definitions point into, or NULL if there is
+ * no cache matching the dbd file.
+ */
+static char *dbd_cache_read(const char *cachename, const char *dbdname, const struct stat *dbdstat,
+                            struct dbd_definitions *list)
+{
+        char expected[512];
+        size_t size;
+        char *buffer = read_file(cachename, &size);
+        char *p, *end;
+
+        if (!buffer) {
+                return NULL;
+        }
+        end = buffer + size;
+        if ((size_t)snprintf(expected, sizeof(expected), DBDCACHEHEADER "%ld %ld %s\n",
+                             (long)dbdstat->st_size, (long)dbdstat->st_mtime, dbdname) >= sizeof(expected) ||
+            size < strlen(expected) || strncmp(buffer, expected, strlen(expected)) != 0) {
+                debug_print("Cache %s does not match %s.\n", cachename, dbdname);
+                free(buffer);
+                return NULL;
+        }
+        for (p = buffer + strlen(expected); p < end; ) {
+                struct dbd_definition *def;
+                char *field[3];
+                int i;
+
+                if (!(def = grow(list->defs, &list->size, list->count, sizeof(struct dbd_definition)))) {
+                        break;
+                }
+                list->defs = def;
+                def = &list->defs[list->count];
+                for (i = 0; i < 3; i++) {
+                        field[i] = p;
+                        while (p < end && *p != ' ' && *p != '\n') p++;
+                        if (p >= end) break;
+                        p++;
+                }
+                if (i < 3 || p[-1] != '\n') break;
+                def->kind = field[0];
+                def->kindlen = field[1] - field[0] - 1;
+                def->name = field[1];
+                def->namelen = field[2] - field[1] - 1;
+                def->len = strtoul(field[2], NULL, 10);
+                def->text = p;
+                if (def->len > (size_t)(end - p)) break;
+                p += def->len;
+                list->count++;
+        }
+        if (p != end) {
+                fprintf(stderr, "require: Cache %s is corrupt.\n", cachename);
+                free(buffer);
+                list->count = 0;
+                return NULL;
+        }
+        return buffer;
+}
+
+static void dbd_cache_write(const char *cachename, const char *dbdname, const struct stat *dbdstat,
+                            const struct dbd_definitions *list)
+{
+        char tmpname[512];
+        FILE *cachefile;
+        int i;
+
+        if ((size_t)snprintf(tmpname, sizeof(tmpname), "%s.%d", cachename, (int)getpid()) >= sizeof(tmpname) ||
+            !(cachefile = fopen(tmpname, "w"))) {
+                debug_print("Can't write cache %s.\n", cachename);
+                return;
+        }
+        fprintf(cachefile, DBDCACHEHEADER "%ld %ld %s\n",
+                (long)dbdstat->st_size, (long)dbdstat->st_mtime, dbdname);
+        for (i = 0; i < list->count; i++) {
+                const struct dbd_definition *def = &list->defs[i];
+                fprintf(cachefile, "%.*s %.*s %lu\n", def->kindlen, def->kind,
+                        def->namelen > 0 ? def->namelen : 1, def->namelen > 0 ? def->name : "-",
+                        (unsigned long)def->len);
+                fwrite(def->text, 1, def->len, cachefile);
+        }
+        if (fclose(cachefile) != 0 || rename(tmpname, cachename) != 0) {
+                remove(tmpname);
+                debug_print("Can't write cache %s.\n", cachename);
+                return;
+        }
+        debug_print("Wrote cache %s.\n", cachename);
+}
+
+/*
+ * Get the top level definitions of a dbd file, from the cache if possible.
+ * text is the contents of the dbd file if already read, or NULL. *buffer is
+ * set to memory the definitions point into, to be freed by the caller.
+ * Returns -1 if the dbd file can't be split.
+ */
+static int dbd_definitions(const char *dbdname, const char *text, size_t textsize,
+                           struct dbd_definitions *list, char **buffer)
+{
+        char cachename[512];
+        struct stat dbdstat;
+        int cached;
+
+        *buffer = NULL;
+        if (stat(dbdname, &dbdstat) != 0) {
+                return -1;
+        }
+        cached = dbd_cache_name(cachename, sizeof(cachename), dbdname);
+        if (cached && (*buffer = dbd_cache_read(cachename, dbdname, &dbdstat, list))) {
+                return 0;
+        }
+        if (!text) {
+                text = *buffer = read_file(dbdname, &textsize);
+        }
+        if (!text || dbd_split(text, textsize, list) != 0) {
+                return -1;
+        }
+        if (cached) {
+                dbd_cache_write(cachename, dbdname, &dbdstat, list);
+        }
+        return 0;
+}
+
+/*
+ * Load a dbd file through its cache. text is the contents of the dbd file
+ * if already read, or NULL. Returns the status of dbReadDatabaseFP(), or 1
+ * if the cache can't be used and the dbd file has to be loaded as a whole.
+ */
+static long load_dbd_cached(const char *dbdname, const char *text, size_t textsize)
+{
+        struct dbd_definitions list = { NULL, 0, 0 };
+        char *buffer = NULL;
+        char *filtered = NULL;
+        size_t len = 0;
+        long status = 1;
+        int skipped = 0;
+        int i;
+
+        if (!requireDbdCache || dbd_definitions(dbdname, text, textsize, &list, &buffer) != 0) {
+                goto out;
+        }
+
+        for (i = 0; i < list.count; i++) {
+                len += list.defs[i].len + 1;
+        }
+        if (!(filtered = malloc(len + 1))) {
+                fprintf(stderr, "require: out of memory.\n");
+                goto out;
+        }
+        for (len = 0, i = 0; i < list.count; i++) {
+                if (dbd_defined(&list.defs[i])) {
+                        skipped++;
+                        continue;
+                }
+                memcpy(filtered + len, list.defs[i].text, list.defs[i].len);
+                len += list.defs[i].len;
+                filtered[len++] = '\n';
+        }
+        debug_print("Skipping %d of %d definitions in %s.\n", skipped, list.count, dbdname);
+        if (len == 0) {
+                status = 0;
+        } else {
+                FILE *dbdfile = fmemopen(filtered, len, "r");
+                if (dbdfile) {
+                        /* Closes dbdfile */
+                        status = dbReadDatabaseFP(&pdbbase, dbdfile, NULL, NULL);
+                }
+        }
+out:
+        free(filtered);
+        free(buffer);
+        free(list.defs);
+        return status;
+}
+#endif
+
+#if defined (__unix__)
+/*
+ * Copy argument n of a definition to buffer, without quotes.
+ */
+static int dbd_argument(const struct dbd_definition *def, int n, char *buffer, size_t size)
+{
+        const char *p = memchr(def->text, '(', def->len);
+        const char *end = def->text + def->len;
+        const char *arg;
+
+        if (!p) return -1;
+        for (p++; n > 0 && p < end; p++) {
+                if (*p == '"') p = dbd_skip_string(p, end) - 1;
+                else if (*p == ',') n--;
+                else if (*p == ')') return -1;
+        }
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p < end && *p == '"') {
+                arg = ++p;
+                while (p < end && *p != '"') p++;
+        } else {
+                arg = p;
+                while (p < end && *p != ',' && *p != ')' && !isspace((unsigned char)*p)) p++;
+        }
+        if (p >= end || (size_t)(p - arg) >= size) return -1;
+        sprintf(buffer, "%.*s", (int)(p - arg), arg);
+        return 0;
+}
+
+/*
+ * If the dbd file adds nothing but device support to pdbbase, return the
+ * device support as lines "<recordtype>\t<choice>". Otherwise return NULL.
+ */
+static char *dbd_device_support(const char *dbdname, const char *text, size_t textsize)
+{
+        struct dbd_definitions list = { NULL, 0, 0 };
+        char *buffer;
+        char *devices = NULL;
+        size_t len = 0;
+        int i;
+
+        if (dbd_definitions(dbdname, text, textsize, &list, &buffer) != 0) {
+                goto out;
+        }
+        if (!(devices = calloc(1, 1))) {
+                goto out;
+        }
+        for (i = 0; i < list.count; i++) {
+                const struct dbd_definition *def = &list.defs[i];
+                char recordtype[64], choice[128];
+                char *p;
+
+                if (def->kindlen == 6 && strncmp(def->kind, "device", 6) == 0 &&
+                    dbd_argument(def, 0, recordtype, sizeof(recordtype)) == 0 &&
+                    dbd_argument(def, 3, choice, sizeof(choice)) == 0) {
+                        if (!(p = realloc(devices, len + strlen(recordtype) + strlen(choice) + 3))) {
+                                goto fail;
+                        }
+                        devices = p;
+                        len += sprintf(devices + len, "%s\t%s\n", recordtype, choice);
+                        continue;
+                }
+                /* Duplicates of what is loaded already add nothing */
+                if (!dbd_defined(def)) {
+                        debug_print("%s needs its library for %.*s(%.*s).\n", dbdname,
+                                    def->kindlen, def->kind, def->namelen, def->name);
+                        goto fail;
+                }
+        }
+        goto out;
+fail:
+        free(devices);
+        devices = NULL;
+out:
+        free(buffer);
+        free(list.defs);
+        return devices;
+}
+
+/*
+ * Check if any record uses one of the device supports.
+ */
+static int device_support_used(const char *devices)
+{
+        char recordtype[64], choice[128];
+        const char *p;
+        int used = 0;
+
+        for (p = devices; !used && sscanf(p, "%63[^\t]\t%127[^\n]", recordtype, choice) == 2; p = strchr(p, '\n') + 1) {
+                DBENTRY dbentry;
+                long status;
+
+                dbInitEntry(pdbbase, &dbentry);
+                if (dbFindRecordType(&dbentry, recordtype) == 0) {
+                        for (status = dbFirstRecord(&dbentry); status == 0 && !used; status = dbNextRecord(&dbentry)) {
+                                used = dbFindField(&dbentry, "DTYP") == 0 && strcmp(dbGetString(&dbentry), choice) == 0;
+                        }
+                }
+                dbFinishEntry(&dbentry);
+        }
+        return used;
+}
+#endif
+
+typedef int (*REGISTERFUNC)(DBBASE *pdbbase);
+
+/*
+ * Call the register function of a module, generated from its dbd file,
+ * directly in the library instead of going through iocsh. Without library
+ * handle the function is looked up in everything loaded so far.
+ */
+static int call_register_function(const char *module, HMODULE libhandle)
+{
+        char symbolname[256];
+        REGISTERFUNC f;
+        int status;
+
+        /* when dbd is loaded call register function for 3.14 */
+        snprintf (symbolname, sizeof(symbolname), "%s_registerRecordDeviceDriver", module);
+#if defined (_WIN32)
+        if (!libhandle) libhandle = GetModuleHandle(NULL);
+#endif
+        if (!(f = (REGISTERFUNC) getAddress(libhandle, symbolname))) {
+                fprintf (stderr, "require: Can't find %s function.\n", symbolname);
+                return -1;
+        }
+        printf ("require: Calling %s function.\n", symbolname);
+        if ((status = f(pdbbase)) != 0) {
+                fprintf (stderr, "require: %s failed with status %d.\n", symbolname, status);
+                return -1;
+        }
+        return 0;
+}
+
+static int load_deferred_deps(const char *deps);
+
+/* Set when the IOC is running, deferred libraries are loaded after the boot */
+static int deferredAfterBoot;
+
+/*
+ * Load the library of a module which was deferred, after the libraries of
+ * its deferred dependencies.
+ */
+static int load_deferred(struct module_entry *m)
+{
+        char libname[256];
+        HMODULE libhandle;
+        double *times = deferredAfterBoot ? m->later : m->times;
+        double start;
+
+        if (!m->deferred || m->deferred == DEFER_UNUSED) {
+                return 0;
+        }
+        m->deferred = 0;
+        if (load_deferred_deps(m->deps) != 0) {
+                return -1;
+        }
+        if (part_path(libname, sizeof(libname), m->path, m->name, CONTENTS_LIB) != 0) {
+                return -1;
+        }
+        printf("require: Loading deferred library %s.\n", libname);
+        start = monotonic();
+        m->handle = libhandle = loadlib(libname);
+        times[PHASE_LIB] += monotonic() - start;
+        if (!libhandle) {
+                return -1;
+        }
+        if (m->contents & CONTENTS_DBD) {
+                int status;
+                start = monotonic();
+                status = call_register_function(m->name, libhandle);
+                times[PHASE_REGISTER] += monotonic() - start;
+                return status;
+        }
+        return 0;
+}
+
+/*
+ * Load the deferred libraries among "module[,version]" separated by spaces.
+ */
+static int load_deferred_deps(const char *deps)
+{
+        char name[100];
+        const char *p;
+        int len;
+
+        for (p = deps; p && *p; p += len) {
+                struct module_entry *dep;
+
+                while (*p == ' ') p++;
+                len = strcspn(p, " ");
+                snprintf(name, sizeof(name), "%.*s", (int)strcspn(p, ", "), p);
+                if ((dep = findModule(name)) && load_deferred(dep) != 0) {
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+static void deferred_init_hook(initHookState state)
+{
+        struct module_entry **loaded;
+        int count, i;
+
+        registry_lock();
+        if (state == initHookAfterIocRunning) {
+                deferredAfterBoot = 1;
+        }
+        loaded = module_list(&count);
+        for (i = 0; i < count; i++) {
+                struct module_entry *m = loaded[i];
+#if defined (__unix__)
+                if (state == initHookAtBeginning && m->deferred == DEFER_DEVICE) {
+                        if (device_support_used(m->devices)) {
+                                load_deferred(m);
+                        } else {
+                                printf("require: Not loading %s, no records use its device support.\n", m->name);
+                                m->deferred = DEFER_UNUSED;
+                        }
+                }
+#endif
+                if (state == initHookAfterIocRunning && m->deferred == DEFER_LIB) {
+                        load_deferred(m);
+                }
+        }
+        registry_unlock();
+}
+
+#if defined (__linux__)
+#include <link.h>
+
+/*
+ * Check if a library without dbd file registers anything, usually iocsh
+ * commands from a C++ constructor. Such a library is needed by the rest of
+ * the startup script already. Reads the undefined symbols of its dynamic
+ * symbol table from the file, an unreadable file counts as registering.
+ * Libraries with dbd file can't be checked this way, the register function
+ * generated from the dbd file uses the same symbols.
+ */
+static int library_registers(const char *libname)
+{
+        ElfW(Ehdr) ehdr;
+        ElfW(Shdr) *shdrs = NULL;
+        ElfW(Sym) *syms = NULL;
+        char *strs = NULL;
+        size_t nsyms = 0, strsize = 0, i;
+        int registers = 1;
+        int fd;
+
+        if ((fd = open(libname, O_RDONLY)) < 0) {
+                return 1;
+        }
+        if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+            ehdr.e_shentsize != sizeof(ElfW(Shdr)) || ehdr.e_shnum == 0 ||
+            !(shdrs = malloc(ehdr.e_shnum * sizeof(ElfW(Shdr)))) ||
+            pread(fd, shdrs, ehdr.e_shnum * sizeof(ElfW(Shdr)), ehdr.e_shoff) != (ssize_t)(ehdr.e_shnum * sizeof(ElfW(Shdr)))) {
+                goto out;
+        }
+        for (i = 0; i < ehdr.e_shnum; i++) {
+                ElfW(Shdr) *strtab;
+                if (shdrs[i].sh_type != SHT_DYNSYM || shdrs[i].sh_link >= ehdr.e_shnum) continue;
+                strtab = &shdrs[shdrs[i].sh_link];
+                nsyms = shdrs[i].sh_size / sizeof(ElfW(Sym));
+                strsize = strtab->sh_size;
+                if (!(syms = malloc(shdrs[i].sh_size + 1)) || !(strs = malloc(strsize + 1)) ||
+                    pread(fd, syms, shdrs[i].sh_size, shdrs[i].sh_offset) != (ssize_t)shdrs[i].sh_size ||
+                    pread(fd, strs, strsize, strtab->sh_offset) != (ssize_t)strsize) {
+                        goto out;
+                }
+                strs[strsize] = '\0';
+                break;
+        }
+        registers = 0;
+        for (i = 0; i < nsyms; i++) {
+                const char *name;
+                if (syms[i].st_shndx != SHN_UNDEF || syms[i].st_name >= strsize) continue;
+                name = strs + syms[i].st_name;
+                if (strncmp(name, "iocshRegister", 13) == 0 || strncmp(name, "registry", 8) == 0) {
+                        debug_print("%s calls %s itself.\n", libname, name);
+                        registers = 1;
+                        break;
+                }
+        }
+out:
+        free(syms);
+        free(strs);
+        free(shdrs);
+        close(fd);
+        return registers;
+}
+#else
+static int library_registers(const char *libname)
+{
+        return 0;
+}
+#endif
+
+/*
+ * Decide if the library of a module can be deferred. Must be called before
+ * the dbd file of the module is loaded.
+ */
+static int defer_library(struct module_entry *entry, struct resolved_module *m,
+                         const char *libname, const char *dbdname, const struct preload *pre)
+{
+        static int hooked = 0;
+
+        if (load_policy() != LOAD_DEFERRED) {
+                return 0;
+        }
+        if (!module_has(m->contents, CONTENTS_DBD, dbdname)) {
+                if (library_registers(libname)) {
+                        return 0;
+                }
+                entry->deferred = DEFER_LIB;
+        }
+#if defined (__unix__)
+        else if ((entry->devices = dbd_device_support(dbdname, pre ? pre->dbd : NULL, pre ? pre->dbdsize : 0))) {
+                entry->deferred = DEFER_DEVICE;
+        }
+#endif
+        if (entry->deferred && !hooked) {
+                hooked = 1;
+                initHookRegister(deferred_init_hook);
+        }
+        return entry->deferred;
+}
+
+/*
+ * Search paths which get the folders of loaded modules. They are kept as
+ * ordered lists of folders without duplicates and written to the
+ * environment only when they have changed, see update_search_paths().
+ */
+enum {
+        SEARCH_DB,       /* db folders */
+        SEARCH_STARTUP,  /* startup folders */
+        SEARCH_BIN,      /* bin folders */
+        SEARCH_MISC,     /* misc folders */
+        SEARCH_PATHS
+};
+
+static const char *searchPathNames[SEARCH_PATHS] = {
+        "EPICS_DB_INCLUDE_PATH",        /* EPICS env variable */
+        "REQUIRE_STARTUP_INCLUDE_PATH", /* require env variable */
+        "REQUIRE_BIN_INCLUDE_PATH",     /* require env variable */
+        "STREAM_PROTOCOL_PATH",         /* streamdevice env variable */
+};
+
+static struct search_path {
+        const char **dirs;  /* Interned, in search order */
+        int count;
+        int size;
+        int dirty;          /* Changed since it was written */
+        char *value;        /* Last value written to the environment */
+} searchPaths[SEARCH_PATHS];
+
+static int search_path_append(struct search_path *path, const char *dir)
+{
+        const char **dirs;
+        int i;
+
+        if (!(dir = intern(dir))) {
+                return -1;
+        }
+        for (i = 0; i < path->count; i++) {
+                if (path->dirs[i] == dir) return 0;
+        }
+        if (!(dirs = grow(path->dirs, &path->size, path->count, sizeof(const char *)))) {
+                return -1;
+        }
+        path->dirs = dirs;
+        path->dirs[path->count++] = dir;
+        path->dirty = 1;
+        return 0;
+}
+
+/*
+ * Start over from the environment if the variable was set by someone else
+ * since we last wrote it, e.g. with epicsEnvSet in the startup script. An
+ * unset variable starts with ".".
+ */
+static int search_path_sync(int which)
+{
+        struct search_path *path = &searchPaths[which];
+        const char *env = getenv(searchPathNames[which]);
+        char *copy, *p, *end;
+        int status = 0;
+
+        if (path->value ? env && strcmp(env, path->value) == 0 : path->count > 0) {
+                return 0;
+        }
+        path->count = 0;
+        path->dirty = 0;
+        free(path->value);
+        path->value = NULL;
+        if (!env) {
+                return search_path_append(path, ".");
+        }
+        if (!(copy = strdup(env))) {
+                fprintf(stderr, "require: out of memory.\n");
+                return -1;
+        }
+        for (p = copy; p && status == 0; p = end) {
+                if ((end = strchr(p, PATHSEP[0]))) *end++ = 0;
+                if (*p) status = search_path_append(path, p);
+        }
+        free(copy);
+        /* The environment already has these folders */
+        path->dirty = 0;
+        path->value = strdup(env);
+        return status;
+}
+
+static int add_search_path(int which, const char *dir)
+{
+        if (search_path_sync(which) != 0) {
+                return -1;
+        }
+        return search_path_append(&searchPaths[which], dir);
+}
+
+/*
+ * Write the search paths which have changed to the environment.
+ */
+static void update_search_paths(void)
+{
+        int i, j;
+
+        for (i = 0; i < SEARCH_PATHS; i++) {
+                struct search_path *path = &searchPaths[i];
+                size_t len = 1;
+                char *value;
+
+                if (!path->dirty) continue;
+                for (j = 0; j < path->count; j++) {
+                        len += strlen(path->dirs[j]) + 1;
+                }
+                if (!(value = malloc(len))) {
+                        fprintf(stderr, "require: out of memory.\n");
+                        continue;
+                }
+                for (len = 0, j = 0; j < path->count; j++) {
+                        len += sprintf(value + len, "%s%s", j ? PATHSEP : "", path->dirs[j]);
+                }
+                setenv(searchPathNames[i], value, 1);
+                debug_print("%s: %s.\n", searchPathNames[i], value);
+                free(path->value);
+                path->value = value;
+                path->dirty = 0;
+        }
+}
+
+/*
+ * Read-through cache of module versions, enabled by REQUIRE_MODULE_CACHE=<dir>.
+ * The parts of a chosen module version which are used at run time on this
+ * platform are copied to <dir>/<module>/<version>-<key> on first use and later
+ * loaded from there. The key is made from the source path and the directories
+ * of the version (see cache_key), so a hit costs a few stat calls on the remote
+ * tree and a reinstalled module gets a new cache entry and the old one ages
+ * out. Files rewritten in place leave the directories unchanged, so on a hit
+ * the libraries and dbd files are also compared by size and mtime with the
+ * manifest of the entry (see cache_stale) and a changed one gives a new copy.
+ * Other files rewritten in place are not noticed. The mtime of the manifest
+ * file in an entry is its last use; entries are evicted least recently used first when
+ * the cache exceeds REQUIRE_MODULE_CACHE_SIZE megabytes (default 2048).
+ */
+#define MODULECACHEMANIFEST ".require.cache"
+#define MODULECACHEHEADER "# require module cache 1 "
+#define MODULECACHESIZE 2048
+#define MODULECACHEGRACE 3600   /* Seconds an entry is protected after use */
+
+#if defined (__unix__)
+static const char *cacheParts[] = {
+        EPICSVERSION DIRSEP "lib" DIRSEP T_A,
+        EPICSVERSION DIRSEP "dbd",
+        EPICSVERSION DIRSEP "bin" DIRSEP T_A,
+        "db",
+        "startup",
+        "misc",
+};
+
+struct cache_file {
+        const char *relpath;  /* Relative to the module directory */
+        off_t size;
+        time_t mtime;
+        mode_t mode;
+};
+
+struct cache_files {
+        struct cache_file *files;
+        int count;
+        int size;
+        off_t total;
+};
+
+/*
+ * Collect the files below base/rel into list.
+ */
+static int cache_walk(const char *base, const char *rel, struct cache_files *list)
+{
+        char path[512], relpath[512];
+        struct dirent *ent;
+        struct stat filestat;
+        DIR *dir;
+        int status = 0;
+
+        snprintf(path, sizeof(path), "%s" DIRSEP "%s", base, rel);
+        if (!(dir = opendir(path))) {
+                return 0;
+        }
+        while (status == 0 && (ent = readdir(dir))) {
+                struct cache_file *files;
+                if (ent->d_name[0] == '.' && (!ent->d_name[1] || (ent->d_name[1] == '.' && !ent->d_name[2]))) continue;
+                if ((size_t)snprintf(relpath, sizeof(relpath), "%s" DIRSEP "%s", rel, ent->d_name) >= sizeof(relpath) ||
+                    (size_t)snprintf(path, sizeof(path), "%s" DIRSEP "%s", base, relpath) >= sizeof(path)) {
+                        fprintf(stderr, "require: Path of %s in %s is too long.\n", ent->d_name, base);
+                        status = -1;
+                        break;
+                }
+                if (stat(path, &filestat) != 0) continue;
+                if (S_ISDIR(filestat.st_mode)) {
+                        status = cache_walk(base, relpath, list);
+                        continue;
+                }
+                if (!S_ISREG(filestat.st_mode)) continue;
+                if (!(files = grow(list->files, &list->size, list->count, sizeof(struct cache_file))) ||
+                    !(files[list->count].relpath = strdup(relpath))) {
+                        if (files) list->files = files;
+                        status = -1;
+                        break;
+                }
+                list->files = files;
+                files[list->count].size = filestat.st_size;
+                files[list->count].mtime = filestat.st_mtime;
+                files[list->count].mode = filestat.st_mode & 0777;
+                list->total += filestat.st_size;
+                list->count++;
+        }
+        closedir(dir);
+        return status;
+}
+
+static int compare_cache_files(const void *a, const void *b)
+{
+        return strcmp(((const struct cache_file *)a)->relpath, ((const struct cache_file *)b)->relpath);
+}
+
+static void free_cache_files(struct cache_files *list)
+{
+        int i;
+        for (i = 0; i < list->count; i++) free((char *)list->files[i].relpath);
+        free(list->files);
+}
+
+/*
+ * Create the directories leading to path.
+ */
+static int make_parents(char *path)
+{
+        char *p;
+        for (p = strchr(path + 1, DIRSEP[0]); p; p = strchr(p + 1, DIRSEP[0])) {
+                *p = '\0';
+                if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+                        *p = DIRSEP[0];
+                        return -1;
+                }
+                *p = DIRSEP[0];
+        }
+        return 0;
+}
+
+static int copy_file(const char *from, const char *to, const struct cache_file *file)
+{
+        char buffer[65536];
+        struct timeval times[2];
+        ssize_t n = 0;
+        int in, out;
+
+        if ((in = open(from, O_RDONLY)) < 0) {
+                return -1;
+        }
+        if ((out = open(to, O_WRONLY|O_CREAT|O_TRUNC, file->mode)) < 0) {
+                close(in);
+                return -1;
+        }
+        while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+                if (write(out, buffer, n) != n) {
+                        n = -1;
+                        break;
+                }
+        }
+        close(in);
+        if (close(out) != 0 || n < 0) {
+                return -1;
+        }
+        times[0].tv_sec = times[1].tv_sec = file->mtime;
+        times[0].tv_usec = times[1].tv_usec = 0;
+        utimes(to, times);
+        return 0;
+}
+
+static void remove_tree(const char *path)
+{
+        char sub[512];
+        struct dirent *ent;
+        struct stat filestat;
+        DIR *dir;
+
+        if (lstat(path, &filestat) != 0) return;
+        if (S_ISDIR(filestat.st_mode) && (dir = opendir(path))) {
+                while ((ent = readdir(dir))) {
+                        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+                        snprintf(sub, sizeof(sub), "%s" DIRSEP "%s", path, ent->d_name);
+                        remove_tree(sub);
+                }
+                closedir(dir);
+                rmdir(path);
+        } else {
+                remove(path);
+        }
+}
+
+/*
+ * Remove least recently used entries until the cache is below its size.
+ * Entries used within MODULECACHEGRACE are kept, other IOCs may be loading
+ * from them.
+ */
+static void cache_evict(const char *cachedir, off_t cap)
+{
+        struct cache_entry {
+                char path[512];
+                time_t used;
+                off_t size;
+        } *entries = NULL, *e;
+        int count = 0, size = 0;
+        off_t total = 0;
+        time_t now = time(NULL);
+        DIR *dir, *moduledir;
+        struct dirent *ent, *vent;
+        char path[600];
+        int i;
+
+        if (!(dir = opendir(cachedir))) return;
+        while ((ent = readdir(dir))) {
+                if (ent->d_name[0] == '.') continue;
+                snprintf(path, sizeof(path), "%s" DIRSEP "%s", cachedir, ent->d_name);
+                if (!(moduledir = opendir(path))) continue;
+                while ((vent = readdir(moduledir))) {
+                        struct stat filestat;
+                        FILE *manifest;
+                        long entrysize = 0;
+                        if (vent->d_name[0] == '.' || strchr(vent->d_name, '-') == NULL) continue;
+                        if (!(e = grow(entries, &size, count, sizeof(struct cache_entry)))) break;
+                        entries = e;
+                        e = &entries[count];
+                        if ((size_t)snprintf(e->path, sizeof(e->path), "%s" DIRSEP "%s" DIRSEP "%s",
+                                             cachedir, ent->d_name, vent->d_name) >= sizeof(e->path)) continue;
+                        snprintf(path, sizeof(path), "%s" DIRSEP MODULECACHEMANIFEST, e->path);
+                        if (stat(path, &filestat) != 0 || !(manifest = fopen(path, "r"))) continue;
+                        if (fscanf(manifest, MODULECACHEHEADER "%ld", &entrysize) != 1) entrysize = 0;
+                        fclose(manifest);
+                        e->used = filestat.st_mtime;
+                        e->size = entrysize;
+                        total += entrysize;
+                        count++;
+                }
+                closedir(moduledir);
+        }
+        closedir(dir);
+        while (total > cap) {
+                e = NULL;
+                for (i = 0; i < count; i++) {
+                        if (entries[i].size < 0 || now - entries[i].used < MODULECACHEGRACE) continue;
+                        if (!e || entries[i].used < e->used) e = &entries[i];
+                }
+                if (!e) break;
+                debug_print("Evicting %s from the module cache.\n", e->path);
+                /* Remove the manifest first, a partly removed entry is never used */
+                snprintf(path, sizeof(path), "%s" DIRSEP MODULECACHEMANIFEST, e->path);
+                remove(path);
+                remove_tree(e->path);
+                total -= e->size;
+                e->size = -1;
+        }
+        free(entries);
+}
 
-        if(modulepath[0] != '\0') {
+/*
+ * Key of a module version in the cache: a hash of its path and of the device,
+ * inode and modification time of the version directory and of the top
+ * directories of its parts. Installing, replacing or removing files in these
+ * directories changes the key without looking at any file. Returns -1 if a
+ * directory was modified within the last second, a change in the same second
+ * would not change the key, then the module is not cached this time.
+ */
+static int cache_key(const char *path, char *key, size_t size)
+{
+        char dirname[512], fingerprint[128];
+        struct stat filestat;
+        time_t now = time(NULL);
+        unsigned long long h = 14695981039346656037ULL;
+        const char *p;
+        int i;
 
-                registerModule(module, version);
-                int env_var_size = strlen(module) + sizeof("REQUIRE__PATH");
-                char *env_var = malloc(env_var_size * sizeof (char));
-                if(!env_var) {
-                        fprintf(stderr, "Out of memory\n");
+        for (p = path; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+        for (i = -1; i < (int)(sizeof(cacheParts)/sizeof(cacheParts[0])); i++) {
+                if (i < 0) {
+                        snprintf(dirname, sizeof(dirname), "%s", path);
+                } else {
+                        snprintf(dirname, sizeof(dirname), "%s" DIRSEP "%s", path, cacheParts[i]);
+                }
+                if (stat(dirname, &filestat) != 0) {
+                        sprintf(fingerprint, " %d -\n", i);
                 } else {
-                        snprintf(env_var, env_var_size, "REQUIRE_%s_PATH", module);
-                        epicsEnvSet(env_var, modulepath);
+                        if (filestat.st_mtime >= now - 1) {
+                                return -1;
+                        }
+                        sprintf(fingerprint, " %d %lu %lu %ld\n", i, (unsigned long)filestat.st_dev,
+                                (unsigned long)filestat.st_ino, (long)filestat.st_mtime);
                 }
+                for (p = fingerprint; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+        }
+        snprintf(key, size, "%016llx", h);
+        return 0;
+}
 
-                snprintf(libname,     size, "%s" DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A DIRSEP PREFIX "%s" INFIX EXT, modulepath, module);
-                snprintf(depname,     size, "%s" DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A DIRSEP "%s.dep", modulepath, module);
-                snprintf(dbdname,     size, "%s" DIRSEP EPICSVERSION DIRSEP "dbd" DIRSEP "%s.dbd", modulepath, module);
-                snprintf(dbname,      size, "%s" DIRSEP "db", modulepath);
-                snprintf(binname,     size, "%s" DIRSEP EPICSVERSION DIRSEP "bin" DIRSEP T_A, modulepath);
-                snprintf(startupname, size, "%s" DIRSEP "startup", modulepath);
-                snprintf(miscname,    size, "%s" DIRSEP "misc", modulepath);
+/*
+ * Check the libraries and dbd files listed in the manifest of a cache entry
+ * against their sources in path. They are what a file copied over an existing
+ * one in the tree, which cache_key does not see, would most likely be.
+ * Returns 1 if one of them differs in size or mtime or is gone, or if the
+ * manifest can't be read.
+ */
+static int cache_stale(const char *manifestpath, const char *path)
+{
+        char line[600], source[1200];
+        struct stat filestat;
+        FILE *manifest;
+        long size, mtime;
+        int n, len, stale = 0;
 
-                debug_print("libname is %s.\n", libname);
-                debug_print("depname is %s.\n", depname);
-                debug_print("dbdname is %s.\n", dbdname);
+        if (!(manifest = fopen(manifestpath, "r"))) {
+                return 1;
+        }
+        if (!fgets(line, sizeof(line), manifest) || strncmp(line, MODULECACHEHEADER, strlen(MODULECACHEHEADER)) != 0) {
+                stale = 1;
+        }
+        while (!stale && fgets(line, sizeof(line), manifest)) {
+                len = strlen(line);
+                if (len == 0 || line[len-1] != '\n' || sscanf(line, "%ld %ld %n", &size, &mtime, &n) != 2) {
+                        stale = 1;
+                        break;
+                }
+                line[len-1] = '\0';
+                if (strncmp(line + n, cacheParts[0], strlen(cacheParts[0])) != 0 &&
+                    strncmp(line + n, cacheParts[1], strlen(cacheParts[1])) != 0) {
+                        continue;
+                }
+                snprintf(source, sizeof(source), "%s" DIRSEP "%s", path, line + n);
+                if (stat(source, &filestat) != 0 || filestat.st_size != size || filestat.st_mtime != mtime) {
+                        debug_print("%s has changed since it was copied to the module cache.\n", source);
+                        stale = 1;
+                }
+        }
+        fclose(manifest);
+        return stale;
+}
 
-                /* parse dependency file and load required modules. */
-                FILE* depfile;
-                char buffer[40];
-                char *rmodule; /* required module */
-                char *rversion; /* required version */
+/*
+ * Point m to its copy in the module cache, copying it first if needed.
+ * Returns 0 also if the cache can't be used and m is left as is.
+ */
+static int cache_module(struct resolved_module *m)
+{
+        const char *cachedir = getenv("REQUIRE_MODULE_CACHE");
+        const char *capstr = getenv("REQUIRE_MODULE_CACHE_SIZE");
+        struct cache_files list = { NULL, 0, 0, 0 };
+        char entry[256], tmpdir[256 + 32], from[512], to[512];
+        char key[64];
+        FILE *manifest;
+        int i;
 
-                if(!(depfile = fopen(depname, "r"))) {
-                        printf("Failed to open %s.\n", depname);
+        if (!cachedir || !cachedir[0] || m->system || strncmp(m->path, cachedir, strlen(cachedir)) == 0) {
+                return 0;
+        }
+        if (cache_key(m->path, key, sizeof(key)) != 0) {
+                debug_print("%s has just been modified, not caching it.\n", m->path);
+                return 0;
+        }
+        if ((size_t)snprintf(entry, sizeof(entry), "%s" DIRSEP "%s" DIRSEP "%s-%s",
+                             cachedir, m->name, m->version, key) >= sizeof(entry)) {
+                debug_print("Cache entry of %s is too long, not caching it.\n", m->path);
+                return 0;
+        }
+        snprintf(to, sizeof(to), "%s" DIRSEP MODULECACHEMANIFEST, entry);
+
+        if (access(to, F_OK) == 0 && cache_stale(to, m->path)) {
+                /* Move the stale copy out of the way in one step, then copy again */
+                snprintf(tmpdir, sizeof(tmpdir), "%s.%d.stale", entry, (int)getpid());
+                if (rename(entry, tmpdir) == 0) {
+                        remove_tree(tmpdir);
+                }
+        }
+        if (access(to, F_OK) == 0) {
+                /* Mark as used */
+                utimes(to, NULL);
+                debug_print("Using %s from the module cache.\n", entry);
+        } else {
+                printf("require: Copying %s to the module cache.\n", m->path);
+                for (i = 0; i < (int)(sizeof(cacheParts)/sizeof(cacheParts[0])); i++) {
+                        if (cache_walk(m->path, cacheParts[i], &list) != 0) {
+                                free_cache_files(&list);
+                                return 0;
+                        }
+                }
+                qsort(list.files, list.count, sizeof(struct cache_file), compare_cache_files);
+                snprintf(tmpdir, sizeof(tmpdir), "%s.%d", entry, (int)getpid());
+                for (i = 0; i < list.count; i++) {
+                        int toolong = (size_t)snprintf(from, sizeof(from), "%s" DIRSEP "%s", m->path, list.files[i].relpath) >= sizeof(from) ||
+                                      (size_t)snprintf(to, sizeof(to), "%s" DIRSEP "%s", tmpdir, list.files[i].relpath) >= sizeof(to);
+                        if (toolong) errno = ENAMETOOLONG;
+                        if (toolong || make_parents(to) != 0 || copy_file(from, to, &list.files[i]) != 0) {
+                                fprintf(stderr, "require: Can't copy %s to the module cache: %s\n", from, strerror(errno));
+                                remove_tree(tmpdir);
+                                free_cache_files(&list);
+                                return 0;
+                        }
+                }
+                snprintf(to, sizeof(to), "%s" DIRSEP MODULECACHEMANIFEST, tmpdir);
+                if (make_parents(to) != 0 || !(manifest = fopen(to, "w"))) {
+                        remove_tree(tmpdir);
+                        free_cache_files(&list);
+                        return 0;
+                }
+                fprintf(manifest, MODULECACHEHEADER "%ld %s\n", (long)list.total, m->path);
+                for (i = 0; i < list.count; i++) {
+                        fprintf(manifest, "%ld %ld %s\n", (long)list.files[i].size, (long)list.files[i].mtime, list.files[i].relpath);
+                }
+                fclose(manifest);
+                /* Another IOC may have been faster, then use its copy */
+                if (rename(tmpdir, entry) != 0) {
+                        remove_tree(tmpdir);
+                        if (access(entry, F_OK) != 0) {
+                                free_cache_files(&list);
+                                return 0;
+                        }
+                }
+                cache_evict(cachedir, (off_t)(capstr ? atol(capstr) : MODULECACHESIZE) * 1024 * 1024);
+        }
+        free_cache_files(&list);
+        strcpy(m->path, entry);
+        return 0;
+}
+#else
+static int cache_module(struct resolved_module *m)
+{
+        return 0;
+}
+#endif
+
+/*
+ * View directory, enabled by REQUIRE_VIEW=<dir>. The folders of the loaded
+ * modules are not added one by one to the search paths but their entries are
+ * linked into <dir>/db, <dir>/startup, <dir>/bin, <dir>/misc and <dir>/lib,
+ * and each search path gets only the one folder of the view. Finding a file
+ * then costs one lookup however many modules are loaded. The directory is
+ * private to the IOC and emptied on the first require. If two modules have an
+ * entry with the same name, the one loaded first wins, as it would in the
+ * search path, and the conflict is reported.
+ */
+#define VIEWLIB "lib"
+
+static const char *viewParts[SEARCH_PATHS] = { "db", "startup", "bin", "misc" };
+
+static struct {
+        int state;          /* 0: not decided, 1: active, -1: not used */
+        char dir[256];
+} view;
+
+#if defined (__unix__)
+/*
+ * Remove the links of the previous boot. Anything else is left alone.
+ */
+static void view_clear(const char *dir)
+{
+        char path[512];
+        struct dirent *ent;
+        struct stat filestat;
+        DIR *d;
+
+        if (!(d = opendir(dir))) return;
+        while ((ent = readdir(d))) {
+                if ((size_t)snprintf(path, sizeof(path), "%s%s", dir, ent->d_name) >= sizeof(path)) continue;
+                if (lstat(path, &filestat) == 0 && S_ISLNK(filestat.st_mode)) {
+                        unlink(path);
+                }
+        }
+        closedir(d);
+}
+
+static int view_open(void)
+{
+        const char *dir;
+        char sub[256 + 16];
+        int i;
+
+        if (view.state != 0) {
+                return view.state;
+        }
+        /* Decided once, all modules have to go into the view or none */
+        view.state = -1;
+        if (!(dir = getenv("REQUIRE_VIEW")) || !dir[0]) {
+                return -1;
+        }
+        if (strlen(dir) >= sizeof(view.dir)) {
+                fprintf(stderr, "require: REQUIRE_VIEW %s is too long.\n", dir);
+                return -1;
+        }
+        strcpy(view.dir, dir);
+        for (i = 0; i <= SEARCH_PATHS; i++) {
+                snprintf(sub, sizeof(sub), "%s" DIRSEP "%s" DIRSEP, view.dir, i < SEARCH_PATHS ? viewParts[i] : VIEWLIB);
+                if (make_parents(sub) != 0) {
+                        fprintf(stderr, "require: Can't create view %s: %s\n", sub, strerror(errno));
                         return -1;
                 }
-                while (fgets(buffer, sizeof(buffer)-1, depfile))
-                {
-                        rmodule = buffer;
-                        /* ignore leading spaces */
-                        while (isspace((int)*rmodule)) rmodule++;
-                        /* ignore empty lines and comment lines */
-                        if (*rmodule == 0 || *rmodule == '#') continue;
-                        /* rmodule at start of module name */
-                        rversion = rmodule;
-                        /* find end of module name */
-                        while (*rversion && *rversion != ',' && !isspace(*rversion)) rversion++;
-                        /* terminate module name */
-                        *rversion++ = 0;
-                        /* Finished if newline is reached */
-                        if(*rversion != '\n') {
-                                /* ignore spaces */
-                                while (isspace((int)*rversion)) rversion++;
-                                /* rversion at start of version */
-                                end = rversion;
-                                /* find end of version */
-                                while (*end && !isspace((int)*end)) end++;
-                                /* append + to version to allow newer compaible versions */
-                                //*end++ = '+';
-                                /* terminate version */
-                                *end = 0;
-                        } else {
-                                *rversion = 0;
+                view_clear(sub);
+        }
+        debug_print("Using view %s.\n", view.dir);
+        return view.state = 1;
+}
+
+/*
+ * Link the entries of the folder dir of module into the part of the view.
+ */
+static int view_link(const char *part, const char *dir, const char *module)
+{
+        char link[512], target[512], existing[512];
+        struct dirent *ent;
+        DIR *d;
+        ssize_t n;
+
+        if (!(d = opendir(dir))) {
+                fprintf(stderr, "require: Can't read %s: %s\n", dir, strerror(errno));
+                return -1;
+        }
+        while ((ent = readdir(d))) {
+                if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+                if ((size_t)snprintf(link, sizeof(link), "%s" DIRSEP "%s" DIRSEP "%s", view.dir, part, ent->d_name) >= sizeof(link) ||
+                    (size_t)snprintf(target, sizeof(target), "%s" DIRSEP "%s", dir, ent->d_name) >= sizeof(target)) {
+                        fprintf(stderr, "require: Can't link %s of %s: %s\n", ent->d_name, module, strerror(ENAMETOOLONG));
+                        closedir(d);
+                        return -1;
+                }
+                if (symlink(target, link) == 0) continue;
+                if (errno != EEXIST) {
+                        fprintf(stderr, "require: Can't link %s: %s\n", link, strerror(errno));
+                        closedir(d);
+                        return -1;
+                }
+                n = readlink(link, existing, sizeof(existing) - 1);
+                existing[n > 0 ? n : 0] = '\0';
+                if (strcmp(existing, target) != 0) {
+                        fprintf(stderr, "require: Conflict in view: %s of %s is hidden by %s.\n",
+                                target, module, existing);
+                }
+        }
+        closedir(d);
+        return 0;
+}
+#else
+static int view_open(void)
+{
+        return view.state = -1;
+}
+
+static int view_link(const char *part, const char *dir, const char *module)
+{
+        return -1;
+}
+#endif
+
+/*
+ * Make the folder dir of module available in the search path.
+ */
+static int add_module_path(int which, const char *dir, const char *module)
+{
+        char viewpart[256 + 16];
+
+        if (view_open() != 1) {
+                return add_search_path(which, dir);
+        }
+        if (view_link(viewParts[which], dir, module) != 0) {
+                return -1;
+        }
+        snprintf(viewpart, sizeof(viewpart), "%s" DIRSEP "%s", view.dir, viewParts[which]);
+        return add_search_path(which, viewpart);
+}
+
+static int load_module_priv(struct resolved_module *m, const struct preload *pre);
+
+static int load_module(struct resolved_module *m, const struct preload *pre)
+{
+        int status;
+        trace_begin("load", m->name);
+        status = load_module_priv(m, pre);
+        trace_end();
+        return status;
+}
+
+/*
+ * Load a resolved module: its library, its dbd file and the folders with its
+ * records, snippets, executables and protocol files, which are added to the
+ * search paths. pre holds what the pipeline worker has prepared, it is NULL
+ * if loading is not pipelined.
+ */
+static int load_module_priv(struct resolved_module *m, const struct preload *pre)
+{
+        const int size = 256;   /* Max size of strings */
+        const char *module = m->name;
+        const char *modulepath = m->path;
+        char libname[size];     /* Path to library file */
+        char dbdname[size];     /* Path to dbd file */
+        char dbname[size];      /* Path to db folder. */
+        char startupname[size]; /* Path to startup folder. */
+        char binname[size];     /* Path to bin folder. */
+        char miscname[size];    /* Path to misc folder. */
+
+        HMODULE libhandle = NULL;
+
+        struct module_entry *entry;
+        double times[PHASES];   /* Used if entry can't be registered */
+        double start;
+        int i;
+
+        if (m->system)
+        {
+                printf("require: Loading system library %s.\n", m->path);
+                profile_add(m->path);
+                start = monotonic();
+                if ((libhandle = loadlib(m->path))) {
+                        if ((entry = registerModule(module, "system", m->path))) {
+                                entry->contents = CONTENTS_LIB;
+                                entry->handle = libhandle;
+                                memcpy(entry->times, m->times, sizeof(entry->times));
+                                entry->times[PHASE_LIB] = monotonic() - start;
                         }
-                        if(rversion[0] == '\0') {
-                                printf("require: %s depends on %s (no version).\n", module, rmodule);
-                        } else {
-                                printf("require: %s depends on %s (%s).\n", module, rmodule, rversion);
+                } else {
+                        debug_print("%s\n","Loading failed.");
+                        return -1;
+                }
+                return 0;
+        }
+
+        if (part_path(libname,     size, modulepath, module, CONTENTS_LIB) != 0 ||
+            part_path(dbdname,     size, modulepath, module, CONTENTS_DBD) != 0 ||
+            part_path(dbname,      size, modulepath, module, CONTENTS_DB) != 0 ||
+            part_path(binname,     size, modulepath, module, CONTENTS_BIN) != 0 ||
+            part_path(startupname, size, modulepath, module, CONTENTS_STARTUP) != 0 ||
+            part_path(miscname,    size, modulepath, module, CONTENTS_MISC) != 0) {
+                return -1;
+        }
+
+        if ((entry = registerModule(module, m->version, modulepath))) {
+                entry->contents = 0;
+                entry->deps = m->deps;
+                m->deps = NULL;
+        }
+        double *t = entry ? entry->times : times;
+        for (i = 0; i < PHASES; i++) {
+                t[i] = m->times[i] + (pre ? pre->times[i] : 0);
+        }
+        int env_var_size = strlen(module) + sizeof("REQUIRE__PATH");
+        char *env_var = malloc(env_var_size * sizeof (char));
+        if(!env_var) {
+                fprintf(stderr, "Out of memory\n");
+        } else {
+                snprintf(env_var, env_var_size, "REQUIRE_%s_PATH", module);
+                epicsEnvSet(env_var, modulepath);
+        }
+
+        debug_print("libname is %s.\n", libname);
+        debug_print("dbdname is %s.\n", dbdname);
+
+        if (load_deferred_deps(entry ? entry->deps : m->deps) != 0) {
+                return -1;
+        }
+        if (module_has(m->contents, CONTENTS_LIB, libname)) {
+                if (entry) entry->contents |= CONTENTS_LIB;
+                if (view_open() == 1) {
+                        /* Also deferred libraries, for executables run by requireExec */
+                        char libdir[sizeof(libname)];
+                        if ((size_t)snprintf(libdir, size, "%s" DIRSEP EPICSVERSION DIRSEP "lib" DIRSEP T_A, modulepath) >= size ||
+                            view_link(VIEWLIB, libdir, module) != 0) {
+                                return -1;
                         }
-                        if (require(rmodule, rversion) != 0)
-                        {
-                                fclose(depfile);
+                }
+                if (entry && defer_library(entry, m, libname, dbdname, pre)) {
+                        printf("require: Deferring library %s.\n", libname);
+                } else {
+                        printf("require: Loading library %s.\n", libname);
+                        profile_add(libname);
+                        start = monotonic();
+                        libhandle = loadlib(libname);
+                        t[PHASE_LIB] += monotonic() - start;
+                        if (!libhandle) {
+                                debug_print("%s.\n","Loading failed.");
                                 return -1;
                         }
+                        if (entry) entry->handle = libhandle;
+                }
+        } else {
+                debug_print("%s\n","no Library to load.");
+        }
+
+        /* Add path to records if db dir exists. */
+        if (module_has(m->contents, CONTENTS_DB, dbname)) {
+                if (entry) entry->contents |= CONTENTS_DB;
+                if (add_module_path(SEARCH_DB, dbname, module) != 0) {
+                        return -1;
+                }
+                printf("require: Adding %s.\n", dbname);
+        } else {
+                debug_print("No db-folder found for module %s.\n", module);
+        }
+
+        /* Add path to snippets if startup dir exists. */
+        if (module_has(m->contents, CONTENTS_STARTUP, startupname)) {
+                if (entry) entry->contents |= CONTENTS_STARTUP;
+                if (add_module_path(SEARCH_STARTUP, startupname, module) != 0) {
+                        return -1;
+                }
+                printf("require: Adding %s.\n", startupname);
+        } else {
+                debug_print("No startup-folder found for module %s.\n", module);
+        }
+
+        /* Add path to executables if startup dir exists. */
+        if (module_has(m->contents, CONTENTS_BIN, binname)) {
+                if (entry) entry->contents |= CONTENTS_BIN;
+                if (add_module_path(SEARCH_BIN, binname, module) != 0) {
+                        return -1;
+                }
+                printf("require: Adding %s.\n", binname);
+        } else {
+                debug_print("No bin-folder found for module %s.\n", module);
+        }
+
+        /* Add path to miscellaneous if misc dir exists. */
+        if (module_has(m->contents, CONTENTS_MISC, miscname)) {
+                if (entry) entry->contents |= CONTENTS_MISC;
+                if (add_module_path(SEARCH_MISC, miscname, module) != 0) {
+                        return -1;
                 }
-                fclose(depfile);
+                printf("require: Adding %s.\n", miscname);
+        } else {
+                debug_print("No misc-folder found for module %s.\n", module);
+        }
 
-                if (stat(libname, &filestat) == 0) {
-                        printf("require: Loading library %s.\n", libname);
-                        if (!(libhandle = loadlib(libname))) {
-                                debug_print("%s.\n","Loading failed.");
-                                return -1;
-                        }
+        /* if dbd file exists and is not empty load it */
+        if (module_has(m->contents, CONTENTS_DBD, dbdname)) {
+                if (entry) entry->contents |= CONTENTS_DBD;
+                FILE *dbdfile = NULL;
+                long status = 1;
+
+                printf("require: Loading %s.\n", dbdname);
+                profile_add(dbdname);
+                start = monotonic();
+#if defined (__unix__)
+                status = load_dbd_cached(dbdname, pre ? pre->dbd : NULL, pre ? pre->dbdsize : 0);
+                if (status == 1 && pre && pre->dbd) {
+                        dbdfile = fmemopen(pre->dbd, pre->dbdsize, "r");
+                }
+#endif
+                if (status != 1) {
+                        /* Loaded from the cache */
+                } else if (dbdfile) {
+                        /* Closes dbdfile */
+                        status = dbReadDatabaseFP(&pdbbase, dbdfile, NULL, NULL);
                 } else {
-                        debug_print("%s\n","no Library to load.");
+                        status = dbLoadDatabase(dbdname, NULL, NULL);
+                }
+                t[PHASE_DBD] += monotonic() - start;
+                if (status != 0)
+                {
+                        fprintf (stderr, "require: can't load %s.\n", dbdname);
+                        return -1;
                 }
 
-                /* Add path to records if db dir exists. */
-                if (stat(dbname, &filestat) == 0) {
-                        p = getenv("EPICS_DB_INCLUDE_PATH");
-                        if (p) {
-                                sprintf(epics_db_include_path, "%s" PATHSEP "%s", p, dbname);
-                        } else {
-                                sprintf(epics_db_include_path, "." PATHSEP "%s", dbname);
+                /* A deferred library is registered when it is loaded */
+                if (!entry || !entry->deferred) {
+                        start = monotonic();
+                        status = call_register_function(module, libhandle);
+                        t[PHASE_REGISTER] += monotonic() - start;
+                        if (status != 0) {
+                                return -1;
                         }
-                        setenv("EPICS_DB_INCLUDE_PATH", epics_db_include_path, 1);
-                        printf("require: Adding %s.\n", dbname);
-                        debug_print("EPICS_DB_INCLUDE_PATH: %s.\n", epics_db_include_path);
-                } else {
-                        debug_print("No db-folder found for module %s.\n", module);
                 }
+        } else {
+                debug_print("No dbd file %s.\n", dbdname);
+        }
+        return 0;
+}
 
-                /* Add path to snippets if startup dir exists. */
-                if (stat(startupname, &filestat) == 0) {
-                        p = getenv("REQUIRE_STARTUP_INCLUDE_PATH");
-                        if (p) {
-                                sprintf(require_startup_include_path, "%s" PATHSEP "%s", p, startupname);
-                        } else {
-                                sprintf(require_startup_include_path, "." PATHSEP "%s", startupname);
+/*
+ * Load the modules in res in order with a pipeline worker thread. Falls back
+ * to loading without the worker if it can't be started.
+ */
+static int load_pipelined(struct resolution *res)
+{
+        struct pipeline pl;
+        int started = 0;
+        int status = 0;
+        int i;
+
+        memset(&pl, 0, sizeof(pl));
+        pl.items = calloc(res->norder, sizeof(struct preload));
+        if (pl.items && (pl.done = epicsEventCreate(epicsEventEmpty))) {
+                for (pl.count = 0; pl.count < res->norder; pl.count++) {
+                        pl.items[pl.count].m = &res->modules[res->order[pl.count]];
+                        if (!(pl.items[pl.count].ready = epicsEventCreate(epicsEventEmpty))) {
+                                break;
                         }
-                        setenv("REQUIRE_STARTUP_INCLUDE_PATH", require_startup_include_path, 1);
-                        printf("require: Adding %s.\n", startupname);
-                        debug_print("REQUIRE_STARTUP_INCLUDE_PATH: %s.\n", require_startup_include_path);
-                } else {
-                        debug_print("No startup-folder found for module %s.\n", module);
                 }
+                started = pl.count == res->norder &&
+                        epicsThreadCreate("requireLoad", epicsThreadPriorityMedium,
+                                epicsThreadGetStackSize(epicsThreadStackMedium),
+                                preload_worker, &pl) != NULL;
+        }
+        if (!started) {
+                debug_print("%s\n", "Can't start pipeline, loading one module at a time.");
+        }
 
-                /* Add path to executables if startup dir exists. */
-                if (stat(binname, &filestat) == 0) {
-                        p = getenv("REQUIRE_BIN_INCLUDE_PATH");
-                        if (p) {
-                                sprintf(require_bin_include_path, "%s" PATHSEP "%s", p, binname);
-                        } else {
-                                sprintf(require_bin_include_path, "." PATHSEP "%s", binname);
-                        }
-                        setenv("REQUIRE_BIN_INCLUDE_PATH", require_bin_include_path, 1);
-                        printf("require: Adding %s.\n", binname);
-                        debug_print("REQUIRE_BIN_INCLUDE_PATH: %s.\n", require_bin_include_path);
-                } else {
-                        debug_print("No bin-folder found for module %s.\n", module);
+        for (i = 0; i < res->norder; i++)
+        {
+                if (started) {
+                        epicsEventMustWait(pl.items[i].ready);
+                }
+                if (load_module(&res->modules[res->order[i]], started ? &pl.items[i] : NULL) != 0)
+                {
+                        status = -1;
+                        break;
                 }
+        }
 
-                /* Add path to miscellaneous if misc dir exists. */
-                if (stat(miscname, &filestat) == 0) {
-                        p = getenv("STREAM_PROTOCOL_PATH");
-                        if (p) {
-                                sprintf(stream_protocol_path, "%s" PATHSEP "%s", p, miscname);
-                        } else {
-                                sprintf(stream_protocol_path, "." PATHSEP "%s", miscname);
+        if (started) {
+                pl.cancel = 1;
+                epicsEventMustWait(pl.done);
+        }
+        if (pl.done) {
+                epicsEventDestroy(pl.done);
+        }
+        for (i = 0; i < pl.count; i++) {
+                free(pl.items[i].dbd);
+                epicsEventDestroy(pl.items[i].ready);
+        }
+        free(pl.items);
+        return status;
+}
+
+static void clear_resolution(struct resolution *res)
+{
+        int i;
+        for (i = 0; i < res->nmodules; i++)
+        {
+                free(res->modules[i].deps);
+        }
+        res->nmodules = 0;
+        res->norder = 0;
+        res->nreqs = 0;
+}
+
+static void free_resolution(struct resolution *res)
+{
+        clear_resolution(res);
+        free(res->modules);
+        free(res->order);
+        free(res->reqs);
+        free(res->pins);
+}
+
+/*
+ * Find out what the resolved modules provide, where the module index did not
+ * tell, with one batch of probes for all of them.
+ */
+static void probe_contents(struct resolution *res)
+{
+        const int nparts = sizeof(contentNames)/sizeof(contentNames[0]);
+        struct probe *probes;
+        int *modules;
+        int i, j, n = 0;
+
+        for (i = 0; i < res->nmodules; i++) {
+                if (!res->modules[i].system && res->modules[i].contents == CONTENTS_UNKNOWN) n++;
+        }
+        if (n == 0) {
+                return;
+        }
+        probes = calloc(n * nparts, sizeof(struct probe));
+        modules = calloc(n, sizeof(int));
+        if (!probes || !modules) {
+                /* module_has() checks one part at a time */
+                free(probes);
+                free(modules);
+                return;
+        }
+        for (i = 0, n = 0; i < res->nmodules; i++) {
+                struct resolved_module *m = &res->modules[i];
+                if (m->system || m->contents != CONTENTS_UNKNOWN) continue;
+                for (j = 0; j < nparts; j++) {
+                        part_path(probes[n * nparts + j].path, sizeof(probes->path), m->path, m->name, contentNames[j].flag);
+                }
+                modules[n++] = i;
+        }
+        probe_paths(probes, n * nparts);
+        for (i = 0; i < n; i++) {
+                struct resolved_module *m = &res->modules[modules[i]];
+                m->contents = 0;
+                for (j = 0; j < nparts; j++) {
+                        const struct probe *p = &probes[i * nparts + j];
+                        /* Empty dbd files are not loaded */
+                        if (p->found && (contentNames[j].flag != CONTENTS_DBD || p->size > 0)) {
+                                m->contents |= contentNames[j].flag;
                         }
-                        setenv("STREAM_PROTOCOL_PATH", stream_protocol_path, 1);
-                        printf("require: Adding %s.\n", miscname);
-                        debug_print("STREAM_PROTOCOL_PATH: %s.\n", stream_protocol_path);
-                } else {
-                        debug_print("No misc-folder found for module %s.\n", module);
                 }
+        }
+        free(probes);
+        free(modules);
+}
+
+/*
+ * Resolve n modules with their versions together and load them with all
+ * their dependencies. The search paths are updated once at the end.
+ */
+static int require_list_priv(int n, const char **modules, const char **versions);
+
+static int require_list(int n, const char **modules, const char **versions)
+{
+    int status;
+
+    registry_lock();
+    status = require_list_priv(n, modules, versions);
+    registry_unlock();
+    return status;
+}
+
+static int require_list_priv(int n, const char **modules, const char **versions)
+{
+    char module_incpath[512];
+    struct resolution res;
+    int retries = 0;
+    int status;
+    double start;
+    int i;
+
+    char *epicsmodules = getenv("EPICS_MODULES_PATH");
+    if(!epicsmodules) {
+            fprintf(stderr, "require: EPICS_MODULES_PATH is not in environment.\n");
+            return -1;
+    }
+    char *p = getenv("EPICS_MODULE_INCLUDE_PATH");
+    snprintf(module_incpath, sizeof(module_incpath), "%s", p ? p : ".");
+    /* Module indexes are checked again */
+    moduleIndexes.generation++;
+
+    /*
+     * Resolve the whole dependency graph first. Nothing is loaded if any
+     * module is missing or conflicting.
+     */
+    memset(&res, 0, sizeof(res));
+    trace_begin("resolve", n == 1 ? modules[0] : NULL);
+    do {
+        clear_resolution(&res);
+        for (i = 0, status = 0; i < n && status == 0; i++)
+        {
+            status = resolve_module(&res, epicsmodules, module_incpath, modules[i], versions[i], NULL);
+        }
+    } while (status == RESOLVE_RETRY && ++retries < MAX_RESOLVE_RETRIES);
+    trace_end();
+
+    if (status == RESOLVE_RETRY)
+    {
+        fprintf(stderr, "require: Giving up resolving dependencies of %s.\n", modules[i-1]);
+    }
+    if (status != 0)
+    {
+        free_resolution(&res);
+        return -1;
+    }
+
+    start = monotonic();
+    probe_contents(&res);
+    start = monotonic() - start;
+    /* Shared by all modules probed */
+    for (i = 0; i < res.norder; i++)
+    {
+        res.modules[res.order[i]].times[PHASE_RESOLVE] += start / res.norder;
+    }
+
+    /* Switch to local copies of the modules if there is a module cache. */
+    for (i = 0; i < res.norder; i++)
+    {
+        struct resolved_module *m = &res.modules[res.order[i]];
+        double start = monotonic();
+        trace_begin("cache", m->name);
+        cache_module(m);
+        trace_end();
+        m->times[PHASE_LIB] += monotonic() - start;
+    }
+
+    /* Load in topological order, dependencies first. */
+    if (requirePipeline && res.norder > 1)
+    {
+        status = load_pipelined(&res);
+    }
+    else for (i = 0; i < res.norder; i++)
+    {
+        if (load_module(&res.modules[res.order[i]], NULL) != 0)
+        {
+            status = -1;
+            break;
+        }
+    }
+    /* Also for the modules loaded before a failure */
+    update_search_paths();
+    free_resolution(&res);
+    return status;
+}
+
+int require_priv(const char* module, const char* vers)
+{
+    if (!module)
+    {
+        char *epicsmodules = getenv("EPICS_MODULES_PATH");
+        printf("Usage: require \"<module>\" [, \"<version>\"].\n");
+        printf("Loads  resources from %s/<module>/<version>.\n", epicsmodules ? epicsmodules : "$EPICS_MODULES_PATH");
+        return -1;
+    }
+    return require_list(1, &module, &vers);
+}
+
+/*
+ * Resolve and load a list of "module[,version]" separated by spaces, as if
+ * they were required one after the other.
+ */
+static int require_many_priv(const char* list)
+{
+    const char **modules;
+    const char **versions;
+    char *buffer, *p, *next;
+    int n = 0;
+    int status;
+
+    if (!(buffer = strdup(list)))
+    {
+        fprintf(stderr, "require: out of memory.\n");
+        return -1;
+    }
+    /* At most one module per two characters */
+    modules = calloc(strlen(list) / 2 + 1, sizeof(char *));
+    versions = calloc(strlen(list) / 2 + 1, sizeof(char *));
+    if (!modules || !versions)
+    {
+        fprintf(stderr, "require: out of memory.\n");
+        free(modules);
+        free(versions);
+        free(buffer);
+        return -1;
+    }
+    for (p = buffer; *p; p = next)
+    {
+        while (isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+        for (next = p; *next && !isspace((unsigned char)*next); next++);
+        if (*next) *next++ = 0;
+        modules[n] = p;
+        if ((p = strchr(p, ','))) {
+            *p++ = 0;
+            versions[n] = p;
+        } else {
+            versions[n] = NULL;
+        }
+        n++;
+    }
+    if (n == 0)
+    {
+        printf("Usage: requireMany \"<module>[,<version>] ...\".\n");
+        status = -1;
+    }
+    else
+    {
+        status = require_list(n, modules, versions);
+    }
+    free(modules);
+    free(versions);
+    free(buffer);
+    return status;
+}
+
+int requireMany(const char* list)
+{
+    int status;
+
+    if (!list)
+    {
+        printf("Usage: requireMany \"<module>[,<version>] ...\".\n");
+        return -1;
+    }
+    trace_begin("requireMany", list);
+    status = require_many_priv(list);
+    trace_end();
+    return require_status(status);
+}
+
+/*
+ * Like requireMany with the modules read from a file. Everything after a
+ * '#' up to the end of the line is a comment.
+ */
+int requireManyFile(const char* filename)
+{
+    FILE *file;
+    char *list = NULL;
+    char line[256];
+    size_t len = 0;
+    int comment = 0;
+    int status;
+
+    if (!filename)
+    {
+        printf("Usage: requireManyFile \"<file>\".\n");
+        return -1;
+    }
+    if (!(file = fopen(filename, "r")))
+    {
+        fprintf(stderr, "require: Can't open %s.\n", filename);
+        return require_status(-1);
+    }
+    /* A long line comes in pieces which are joined as they are */
+    while (fgets(line, sizeof(line), file))
+    {
+        size_t n = strlen(line);
+        int eol = n > 0 && line[n-1] == '\n';
+        char *p, *l;
+        if (comment) line[0] = 0;
+        else if ((p = strchr(line, '#')))
+        {
+            *p = 0;
+            comment = 1;
+        }
+        if (!(l = realloc(list, len + strlen(line) + 2)))
+        {
+            fprintf(stderr, "require: out of memory.\n");
+            free(list);
+            fclose(file);
+            return require_status(-1);
+        }
+        list = l;
+        len += sprintf(list + len, "%s%s", line, comment && eol ? " " : "");
+        if (eol) comment = 0;
+    }
+    fclose(file);
+    status = requireMany(list ? list : "");
+    free(list);
+    return status;
+}
+
+#define LOCKHEADER "# require lock 2 " EPICSVERSION " " T_A "\n"
+
+/*
+ * Write all modules loaded by require to a lockfile, in load order, with
+ * their exact versions, files, include folders and dependencies. A later
+ * boot can read it with requireFromLock() and skip searching for modules.
+ *
+ * Each line is
+ *   <module> <version> <path> <lib> <dbd> <db> <startup> <bin> <misc> [<dependency>...]
+ * where the path and the parts are written as <length> <path>, as they may
+ * contain spaces, and missing parts as '-'.
+ */
+static int lock_count(void)
+{
+        struct module_entry **loaded;
+        int n = 0;
+        int i, count;
+
+        loaded = module_list(&count);
+        for (i = 0; i < count; i++)
+        {
+                if (loaded[i]->path[0] != '\0') n++;
+        }
+        return n;
+}
+
+static void write_lock_path(FILE *lockfile, const char *path)
+{
+        if (!path)
+        {
+                fputs(" -", lockfile);
+        }
+        else
+        {
+                fprintf(lockfile, " %lu %s", (unsigned long)strlen(path), path);
+        }
+}
+
+static int write_lock(FILE *lockfile)
+{
+        struct module_entry **loaded;
+        struct module_entry *m;
+        char partname[256];
+        int n = 0;
+        int i, j, count;
 
-                /* if dbd file exists and is not empty load it */
-                if (stat(dbdname, &filestat) == 0 && filestat.st_size > 0) {
-                        printf("require: Loading %s.\n", dbdname);
-                        if (dbLoadDatabase(dbdname, NULL, NULL) != 0)
+        loaded = module_list(&count);
+        for (i = 0; i < count; i++)
+        {
+                m = loaded[i];
+                /* External modules are linked into the application */
+                if (m->path[0] == '\0') continue;
+                n++;
+                fprintf(lockfile, "%s %s", m->name, m->version);
+                write_lock_path(lockfile, m->path);
+                for (j = 0; j < (int)(sizeof(contentNames)/sizeof(contentNames[0])); j++)
+                {
+                        if (!(m->contents & contentNames[j].flag))
+                        {
+                                write_lock_path(lockfile, NULL);
+                        }
+                        else if (strcmp(m->version, "system") == 0)
+                        {
+                                write_lock_path(lockfile, m->path);
+                        }
+                        else if (part_path(partname, sizeof(partname), m->path, m->name, contentNames[j].flag) != 0)
                         {
-                                fprintf (stderr, "require: can't load %s.\n", dbdname);
                                 return -1;
                         }
-
-                        /* when dbd is loaded call register function for 3.14 */
-                        sprintf (symbolname, "%s_registerRecordDeviceDriver", module);
-                        printf ("require: Calling %s function.\n", symbolname);
-#ifdef vxWorks
+                        else
                         {
-                                FUNCPTR f = (FUNCPTR) getAddress(NULL, symbolname);
-                                if (f)
-                                        f(pdbbase);
-                                else
-                                        fprintf (stderr, "require: Can't find %s function.\n", symbolname);
+                                write_lock_path(lockfile, partname);
                         }
-#else
-                        iocshCmd(symbolname);
-#endif
-                } else {
-                        debug_print("No dbd file %s.\n", dbdname);
                 }
-        } else {
-                debug_print("Could not find an EPICS module named \"%s\". Looking for "
-                            "system libraries.\n", module);
-                /* Might be a system library. Search for library in
-                 * module_incpath. */
-                char fulllibname[size];
-                char libdir[size];
-                char syslibname[size];
-                snprintf(syslibname, sizeof(syslibname), PREFIX "%s" INFIX EXT, module);
-                for (p = module_incpath; p != NULL; p = end) {
-                        end = strchr(p, sep[0]);
-                        if (end) {
-                                snprintf (libdir, sizeof(libdir), "%.*s", (int)(end-p), p);
-                                end++;
-                        } else {
-                                snprintf (libdir, sizeof(libdir), "%s", p);
-                        }
-                        /* ignore empty module_incpath elements */
-                        if (libdir[0] == 0) continue;
+                if (m->deps) fprintf(lockfile, " %s", m->deps);
+                fputc('\n', lockfile);
+        }
+        return n;
+}
 
-                        sprintf (fulllibname, "%s" DIRSEP "%s", libdir, syslibname);
-                        debug_print("looking for %s.\n", fulllibname);
-                        if (stat(fulllibname, &filestat) == 0) break;
-#ifdef vxWorks
-                        /* now without the .munch */
-                        fulllibname[strlen(fulllibname)-6] = 0;
-                        debug_print("looking for %s.\n", fulllibname);
-                        if (stat(fulllibname, &filestat) == 0) break;
-#endif
+int requireLock(const char *filename)
+{
+        FILE *lockfile;
+        int n;
+
+        if (!filename || !filename[0])
+        {
+                printf("Usage: requireLock \"<lockfile>\".\n");
+                return -1;
+        }
+        if (!(lockfile = fopen(filename, "w")))
+        {
+                fprintf(stderr, "require: Can't open %s for writing.\n", filename);
+                return -1;
+        }
+        fputs(LOCKHEADER, lockfile);
+        registry_lock();
+        n = write_lock(lockfile);
+        registry_unlock();
+        if (fclose(lockfile) != 0 || n < 0)
+        {
+                fprintf(stderr, "require: Failed to write %s.\n", filename);
+                return -1;
+        }
+        printf("require: Wrote %d modules to %s.\n", n, filename);
+        return 0;
+}
+
+static void free_lock(struct resolved_module *modules, int n)
+{
+        int j;
+
+        for (j = 0; j < n; j++) free(modules[j].deps);
+        free(modules);
+}
+
+/*
+ * Use the modules read by read_lock() for the following require calls.
+ */
+static void use_lock(struct resolved_module *modules, int n)
+{
+        free_lock(lockedModules, nlocked);
+        lockedModules = modules;
+        nlocked = n;
+}
+
+/*
+ * Read a path written by write_lock_path() at *p into path (if not NULL) and
+ * advance *p past it. Returns 1 if there is a path, 0 for '-' and -1 if the
+ * field is malformed or the path does not fit.
+ */
+static int read_lock_path(char **p, char *path, size_t size)
+{
+        char *s = *p;
+        unsigned long len;
+        int consumed;
+        int status = 0;
+
+        if (*s++ != ' ')
+        {
+                return -1;
+        }
+        if (*s == '-')
+        {
+                s++;
+        }
+        else
+        {
+                if (!isdigit((unsigned char)*s) || sscanf(s, "%lu%n", &len, &consumed) != 1 ||
+                    s[consumed] != ' ' || strlen(s + consumed + 1) <= len)
+                {
+                        return -1;
+                }
+                s += consumed + 1;
+                if (path)
+                {
+                        if (len >= size) return -1;
+                        memcpy(path, s, len);
+                        path[len] = '\0';
+                }
+                s += len;
+                status = 1;
+        }
+        if (*s != ' ' && *s != '\n')
+        {
+                return -1;
+        }
+        *p = s;
+        return status;
+}
+
+/*
+ * Read up to max lines (all if max < 0) written by write_lock() into
+ * *modules, to be passed to use_lock(). Returns the number of modules read.
+ */
+static int read_lock(FILE *lockfile, const char *filename, int *line, int max, struct resolved_module **result)
+{
+        char buffer[4096];
+        struct resolved_module *modules = NULL;
+        int n = 0, size = 0;
+        int j;
+
+        while (max-- != 0 && fgets(buffer, sizeof(buffer), lockfile))
+        {
+                struct resolved_module *m;
+                int consumed = 0;
+                int status = -1;
+                char *deps;
+
+                (*line)++;
+                if (!strchr(buffer, '\n') && !feof(lockfile))
+                {
+                        fprintf(stderr, "require: %s:%d: line too long.\n", filename, *line);
+                        break;
+                }
+                if (buffer[0] == '#' || buffer[0] == '\n') continue;
+                if (!(m = grow(modules, &size, n, sizeof(struct resolved_module))))
+                {
+                        break;
+                }
+                modules = m;
+                m = &modules[n];
+                memset(m, 0, sizeof(*m));
+                if (sscanf(buffer, "%99s %19s%n", m->name, m->version, &consumed) == 2)
+                {
+                        deps = buffer + consumed;
+                        status = read_lock_path(&deps, m->path, sizeof(m->path));
                 }
-                if (!p) {
-                        debug_print("require: \"%s\" not found in %s.\n",
-                                        syslibname, module_incpath);
-                        return -1;
+                for (j = 0; status == 1 && j < (int)(sizeof(contentNames)/sizeof(contentNames[0])); j++)
+                {
+                        int has = read_lock_path(&deps, NULL, 0);
+                        if (has < 0) status = -1;
+                        else if (has > 0) m->contents |= contentNames[j].flag;
                 }
-                printf("require: Loading system library %s.\n", fulllibname);
-                if ((libhandle = loadlib(fulllibname))) {
-                        registerModule(module, "system");
-                } else {
-                        debug_print("%s\n","Loading failed.");
-                        return -1;
+                if (status != 1)
+                {
+                        fprintf(stderr, "require: %s:%d: malformed line.\n", filename, *line);
+                        continue;
+                }
+                m->system = strcmp(m->version, "system") == 0;
+                while (isspace((int)*deps)) deps++;
+                deps[strcspn(deps, "\n")] = 0;
+                if (deps[0] && !(m->deps = strdup(deps)))
+                {
+                        fprintf(stderr, "require: out of memory.\n");
+                        continue;
                 }
+                n++;
         }
+        *result = modules;
+        return n;
+}
+
+/*
+ * Read a lockfile written by requireLock(). Modules required afterwards are
+ * taken from the lockfile if the locked version satisfies the request and
+ * the module still exists. Everything else is searched for as usual.
+ */
+int requireFromLock(const char *filename)
+{
+        struct resolved_module *modules = NULL;
+        FILE *lockfile;
+        char buffer[256];
+        int line = 1;
+        int n;
 
+        if (!filename || !filename[0])
+        {
+                printf("Usage: requireFromLock \"<lockfile>\".\n");
+                return -1;
+        }
+        if (!(lockfile = fopen(filename, "r")))
+        {
+                fprintf(stderr, "require: Can't open lockfile %s.\n", filename);
+                return -1;
+        }
+        if (!fgets(buffer, sizeof(buffer), lockfile) || strcmp(buffer, LOCKHEADER) != 0)
+        {
+                fprintf(stderr, "require: %s is not a lockfile for " EPICSVERSION " " T_A ".\n", filename);
+                fclose(lockfile);
+                return -1;
+        }
+        n = read_lock(lockfile, filename, &line, -1, &modules);
+        fclose(lockfile);
+        registry_lock();
+        use_lock(modules, n);
+        registry_unlock();
+        printf("require: Read %d locked modules from %s.\n", n, filename);
         return 0;
-    }
 }
 
 int dbLoadRecordsTemplate(const char *file, const char *subs) {
@@ -1149,21 +5984,37 @@ int requireExec(const char *executable, const char *args, const char *outfile, c
                         debug_print("[%d]: Executing %s %s\n", cpid, execname, args);
                 }
                 i = 0;
-                char *ld_library_path = calloc(2048, sizeof(char));
+                struct module_entry **loaded;
+                struct module_entry *m;
+                int count;
+                size_t len = 1;
+                if (view.state == 1) {
+                        /* All module libraries are in the view */
+                        len += strlen(view.dir) + sizeof("/" VIEWLIB);
+                }
+                loaded = module_list(&count);
+                for (i = 0; i < count; i++) {
+                        len += strlen(loaded[i]->path) + sizeof(":/" EPICSVERSION "/lib/" T_A "/");
+                }
+                char *ld_library_path = calloc(len, sizeof(char));
                 if(ld_library_path == NULL) {
                         fprintf(stderr, "require: Out of memory\n");
+                        exit(127);
                 }
-                struct module_list *iter;
-                char *modules_path = getenv("EPICS_MODULES_PATH");
-                for (iter = loadedModules; iter != NULL; iter=iter->next) {
-                        if(iter != loadedModules) {
+                if (view.state == 1) {
+                        strcat(ld_library_path, view.dir);
+                        strcat(ld_library_path, "/" VIEWLIB);
+                }
+                for (i = 0; view.state != 1 && i < count; i++) {
+                        m = loaded[i];
+                        /* Skip external modules and system libraries */
+                        if(m->path[0] == '\0' || strcmp(m->version, "system") == 0) {
+                                continue;
+                        }
+                        if(ld_library_path[0] != '\0') {
                                 strcat(ld_library_path, ":");
                         }
-                        strcat(ld_library_path, modules_path);
-                        strcat(ld_library_path, "/");
-                        strcat(ld_library_path, iter->name);
-                        strcat(ld_library_path, "/");
-                        strcat(ld_library_path, iter->version);
+                        strcat(ld_library_path, m->path);
                         strcat(ld_library_path, "/" EPICSVERSION "/lib/" T_A "/");
                 }
                 setenv("LD_LIBRARY_PATH", ld_library_path, 1);
@@ -1181,6 +6032,518 @@ int requireExec(const char *executable, const char *args, const char *outfile, c
 }
 #endif
 
+/*
+ * Snapshot of the database. After requireFromSnapshot() all calls loading
+ * records (dbLoadRecords, dbLoadTemplate and dbLoadRecordsTemplate from the
+ * shell) are recorded with size and modification time of their file and a
+ * fingerprint of the files they include or expand. requireSnapshot() writes
+ * the loaded modules, these calls and all records in pdbbase to an image file.
+ *
+ * requireFromSnapshot() at the beginning of the next boot takes the modules
+ * from the image like requireFromLock() and skips the calls as long as they
+ * match the recorded ones. At iocInit the records are then read from the
+ * image in one go, without macro substitution, template expansion or msi.
+ * If a call differs from the snapshot, or a file has changed, the calls
+ * skipped so far are run and the image is not used any more.
+ *
+ * The image is
+ *   SNAPSHOTHEADER
+ *   modules <n>, followed by n lines as in a lockfile
+ *   calls <n>, followed by n lines
+ *     <command> <size> <mtime> <fingerprint> <length of file> <file> <length of macros> <macros>
+ *   records <length>, followed by the records as written by dbWriteRecordFP()
+ */
+#define SNAPSHOTHEADER "# require snapshot 3 " EPICSVERSION " " T_A "\n"
+#define LOADCALLDEPTH 8
+
+struct load_call {
+        const char *command;  /* Interned */
+        char *file;
+        char *macros;         /* NULL if none */
+        long size;            /* Of file, -1 if not found */
+        long mtime;
+        unsigned int files;   /* Fingerprint of the files read by file, 0 if unknown */
+};
+
+static struct {
+        struct load_call *calls;   /* Calls of this boot */
+        int ncalls;
+        int callssize;
+        struct load_call *image;   /* Calls in the image */
+        int nimage;
+        int next;                  /* Next call expected from the image */
+        int recording;             /* Recording calls for requireSnapshot */
+        int replaying;             /* Skipping calls found in the image */
+        char *records;             /* Records in the image */
+        size_t recordssize;
+        char *filename;
+} snapshot;
+
+/*
+ * Find file like dbLoadRecords does, in EPICS_DB_INCLUDE_PATH if it has no
+ * path. Returns 1 and the file name in filename and its status in filestat if
+ * found.
+ */
+static int db_file_find(const char *file, char *filename, size_t size, struct stat *filestat)
+{
+        const char *include_path = getenv("EPICS_DB_INCLUDE_PATH");
+        const char *p, *end;
+
+        snprintf(filename, size, "%s", file);
+        if (stat(filename, filestat) == 0) {
+                return 1;
+        }
+        if (strchr(file, DIRSEP[0])) {
+                return 0;
+        }
+        for (p = include_path; p; p = end) {
+                end = strchr(p, PATHSEP[0]);
+                snprintf(filename, size, "%.*s" DIRSEP "%s",
+                         end ? (int)(end - p) : (int)strlen(p), p, file);
+                if (stat(filename, filestat) == 0) {
+                        return 1;
+                }
+                if (end) end++;
+        }
+        return 0;
+}
+
+/*
+ * Add the files named in filename by "include" (databases and templates) or
+ * "file" (substitutions) to the fingerprint h, with their size and
+ * modification time, and the files they name in turn. The names are
+ * expanded with the macros of the call. Returns -1 if a name uses other
+ * macros, like those of a substitution pattern, then the files are unknown.
+ */
+static int load_call_scan(const char *filename, MAC_HANDLE *mac, unsigned int *h, int depth)
+{
+        struct stat filestat;
+        char name[256], expanded[512], path[512], fingerprint[64];
+        char *text, *p, *end;
+        const char *q;
+        size_t size;
+        int status = 0;
+
+        if (depth > LOADCALLDEPTH) {
+                return -1;
+        }
+        if (!(text = read_file(filename, &size))) {
+                return 0;
+        }
+        for (p = text, end = text + size; p < end && status == 0; ) {
+                const char *word = p;
+                size_t len = 0;
+
+                if (*p == '#') {
+                        while (p < end && *p != '\n') p++;
+                        continue;
+                }
+                if (*p == '"') {
+                        for (p++; p < end && *p != '"'; p++) {
+                                if (*p == '\\') p++;
+                        }
+                        p++;
+                        continue;
+                }
+                if (!isalpha((unsigned char)*p)) {
+                        p++;
+                        continue;
+                }
+                while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+                if (!(p - word == 7 && strncmp(word, "include", 7) == 0) &&
+                    !(p - word == 4 && strncmp(word, "file", 4) == 0)) {
+                        continue;
+                }
+                while (p < end && (*p == ' ' || *p == '\t')) p++;
+                if (p < end && *p == '"') {
+                        for (p++; p < end && *p != '"' && *p != '\n'; p++) {
+                                if (len < sizeof(name) - 1) name[len++] = *p;
+                        }
+                        if (p < end && *p == '"') p++;
+                } else if (p < end && (isalnum((unsigned char)*p) || strchr("_./$", *p))) {
+                        for (; p < end && !isspace((unsigned char)*p) && *p != '{'; p++) {
+                                if (len < sizeof(name) - 1) name[len++] = *p;
+                        }
+                }
+                name[len] = '\0';
+                if (len == 0) {
+                        continue;
+                }
+                if (macExpandString(mac, name, expanded, sizeof(expanded)) < 0) {
+                        debug_print("Can't expand \"%s\" in %s.\n", name, filename);
+                        status = -1;
+                        break;
+                }
+                if (db_file_find(expanded, path, sizeof(path), &filestat)) {
+                        profile_add(path);
+                        sprintf(fingerprint, " %ld %ld\n", (long)filestat.st_size, (long)filestat.st_mtime);
+                        status = load_call_scan(path, mac, h, depth + 1);
+                } else {
+                        strcpy(path, expanded);
+                        strcpy(fingerprint, " -1\n");
+                }
+                for (q = path; *q; q++) *h = (*h ^ (unsigned char)*q) * 16777619u;
+                for (q = fingerprint; *q; q++) *h = (*h ^ (unsigned char)*q) * 16777619u;
+        }
+        free(text);
+        return status;
+}
+
+/*
+ * Size and modification time of the file of call, and the fingerprint of the
+ * files it reads.
+ */
+static void load_call_stat(struct load_call *call)
+{
+        struct stat filestat;
+        char filename[512];
+        MAC_HANDLE *mac;
+        char **pairs = NULL;
+        unsigned int h = 2166136261u;
+        int found;
+
+        found = db_file_find(call->file, filename, sizeof(filename), &filestat);
+        call->size = found ? (long)filestat.st_size : -1;
+        call->mtime = found ? (long)filestat.st_mtime : 0;
+        call->files = 0;
+        if (!found) {
+                return;
+        }
+        profile_add(filename);
+        if (macCreateHandle(&mac, NULL) != 0) {
+                return;
+        }
+        macSuppressWarning(mac, 1);
+        if (call->macros && macParseDefns(mac, call->macros, &pairs) >= 0) {
+                macInstallMacros(mac, pairs);
+        }
+        free(pairs);
+        if (load_call_scan(filename, mac, &h, 0) == 0) {
+                call->files = h ? h : 1;
+        }
+        macDeleteHandle(mac);
+}
+
+static void load_calls_free(struct load_call *calls, int n)
+{
+        int i;
+
+        for (i = 0; i < n; i++) {
+                free(calls[i].file);
+                free(calls[i].macros);
+        }
+        free(calls);
+}
+
+static int load_call_equal(const struct load_call *a, const struct load_call *b)
+{
+        return a->command == b->command && strcmp(a->file, b->file) == 0 &&
+                strcmp(a->macros ? a->macros : "", b->macros ? b->macros : "") == 0 &&
+                a->size == b->size && a->mtime == b->mtime &&
+                a->files != 0 && a->files == b->files;
+}
+
+static void load_call_run(const struct load_call *call)
+{
+        if (strcmp(call->command, "dbLoadRecords") == 0) {
+                dbLoadRecords(call->file, call->macros);
+        } else if (strcmp(call->command, "dbLoadTemplate") == 0) {
+                dbLoadTemplate(call->file, call->macros);
+        } else {
+                dbLoadRecordsTemplate(call->file, call->macros);
+        }
+}
+
+/* Stop using the image and run the calls skipped so far */
+static void snapshot_abandon(const char *reason)
+{
+        int i;
+
+        printf("require: %s, not using snapshot %s.\n", reason, snapshot.filename);
+        snapshot.replaying = 0;
+        for (i = 0; i < snapshot.next; i++) {
+                load_call_run(&snapshot.image[i]);
+        }
+}
+
+/*
+ * Record a call loading records. Returns 1 if the call is skipped because
+ * its records come from the image, 0 if the call has to be run.
+ */
+static int load_call_priv(const char *command, const char *file, const char *macros);
+
+static int load_call(const char *command, const char *file, const char *macros)
+{
+        int status;
+
+        registry_lock();
+        status = load_call_priv(command, file, macros);
+        registry_unlock();
+        return status;
+}
+
+static int load_call_priv(const char *command, const char *file, const char *macros)
+{
+        struct load_call *calls;
+        struct load_call *call;
+
+        if (!file) {
+                return 0;
+        }
+        if (!snapshot.recording) {
+                /* Only the boot profile wants the file */
+                if (profile.enabled) {
+                        struct stat filestat;
+                        char filename[512];
+                        if (db_file_find(file, filename, sizeof(filename), &filestat)) profile_add(filename);
+                }
+                return 0;
+        }
+        if (!(calls = grow(snapshot.calls, &snapshot.callssize, snapshot.ncalls, sizeof(struct load_call)))) {
+                return 0;
+        }
+        snapshot.calls = calls;
+        call = &snapshot.calls[snapshot.ncalls];
+        call->command = intern(command);
+        call->file = strdup(file);
+        call->macros = macros ? strdup(macros) : NULL;
+        if (!call->command || !call->file || (macros && !call->macros)) {
+                fprintf(stderr, "require: out of memory.\n");
+                free(call->file);
+                free(call->macros);
+                return 0;
+        }
+        load_call_stat(call);
+        snapshot.ncalls++;
+
+        if (!snapshot.replaying) {
+                return 0;
+        }
+        if (snapshot.next < snapshot.nimage && load_call_equal(call, &snapshot.image[snapshot.next])) {
+                debug_print("%s %s is in the snapshot.\n", command, file);
+                snapshot.next++;
+                return 1;
+        }
+        snapshot_abandon(snapshot.next < snapshot.nimage ? "Startup differs from snapshot" : "More records loaded than in snapshot");
+        return 0;
+}
+
+static void snapshot_init_hook(initHookState state)
+{
+        FILE *recordsfile = NULL;
+
+        if (state != initHookAtBeginning || !snapshot.replaying) {
+                return;
+        }
+        if (snapshot.next != snapshot.nimage) {
+                snapshot_abandon("Fewer records loaded than in snapshot");
+                return;
+        }
+        snapshot.replaying = 0;
+#if defined (__unix__)
+        if (snapshot.recordssize > 0) {
+                recordsfile = fmemopen(snapshot.records, snapshot.recordssize, "r");
+        }
+#endif
+        if (snapshot.recordssize > 0 && !recordsfile) {
+                snapshot_abandon("Can't read records from memory");
+                return;
+        }
+        printf("require: Loading records from snapshot %s.\n", snapshot.filename);
+        /* Closes recordsfile */
+        if (recordsfile && dbReadDatabaseFP(&pdbbase, recordsfile, NULL, NULL) != 0) {
+                fprintf(stderr, "require: Can't load records from snapshot %s.\n", snapshot.filename);
+        }
+        free(snapshot.records);
+        snapshot.records = NULL;
+}
+
+static void snapshot_write_call(FILE *file, const struct load_call *call)
+{
+        fprintf(file, "%s %ld %ld %08x %lu %s %lu %s\n", call->command, call->size, call->mtime, call->files,
+                (unsigned long)strlen(call->file), call->file,
+                (unsigned long)(call->macros ? strlen(call->macros) : 0), call->macros ? call->macros : "");
+}
+
+/*
+ * Write the loaded modules, the calls loading records and all records to an
+ * image file. To be called just before iocInit.
+ */
+int requireSnapshot(const char *filename)
+{
+        FILE *file;
+        char tmpname[512];
+        long lengthpos, recordsstart, recordsend;
+        int nmodules, ncalls;
+        int i;
+
+        if (!filename || !filename[0]) {
+                printf("Usage: requireSnapshot \"<imagefile>\".\n");
+                return -1;
+        }
+        if (!pdbbase) {
+                fprintf(stderr, "require: No database loaded.\n");
+                return -1;
+        }
+        if (!snapshot.recording) {
+                fprintf(stderr, "require: Calls loading records are only recorded after requireFromSnapshot.\n");
+                return -1;
+        }
+        /* Write to a temporary file, the image may be in use */
+        snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+        if (!(file = fopen(tmpname, "w+"))) {
+                fprintf(stderr, "require: Can't open %s for writing.\n", tmpname);
+                return -1;
+        }
+        fputs(SNAPSHOTHEADER, file);
+        registry_lock();
+        nmodules = lock_count();
+        fprintf(file, "modules %d\n", nmodules);
+        if (write_lock(file) < 0) {
+                registry_unlock();
+                fclose(file);
+                fprintf(stderr, "require: Failed to write %s.\n", filename);
+                remove(tmpname);
+                return -1;
+        }
+        ncalls = snapshot.ncalls;
+        fprintf(file, "calls %d\n", ncalls);
+        for (i = 0; i < ncalls; i++) {
+                snapshot_write_call(file, &snapshot.calls[i]);
+        }
+        registry_unlock();
+        /* Length of the records is filled in afterwards */
+        lengthpos = ftell(file);
+        fprintf(file, "records %20s\n", "");
+        recordsstart = ftell(file);
+        dbWriteRecordFP(pdbbase, file, NULL, 0);
+        recordsend = ftell(file);
+        fseek(file, lengthpos, SEEK_SET);
+        fprintf(file, "records %20ld", recordsend - recordsstart);
+        if (fclose(file) != 0 || rename(tmpname, filename) != 0) {
+                fprintf(stderr, "require: Failed to write %s.\n", filename);
+                remove(tmpname);
+                return -1;
+        }
+        printf("require: Wrote snapshot of %d modules and %d calls to %s.\n", nmodules, ncalls, filename);
+        return 0;
+}
+
+/*
+ * Read an image written by requireSnapshot(). The modules in it are used
+ * like in a lockfile and the records are loaded from it at iocInit if the
+ * startup loads the same records from the same files.
+ */
+int requireFromSnapshot(const char *filename)
+{
+        FILE *file;
+        char buffer[8192];
+        struct resolved_module *modules = NULL;
+        struct load_call *calls = NULL;
+        char *records = NULL;
+        int ncalls = 0, callssize = 0;
+        int nmodules, n;
+        unsigned long size;
+        char *p;
+        int line = 1;
+        static int hooked = 0;
+
+        if (!filename || !filename[0]) {
+                printf("Usage: requireFromSnapshot \"<imagefile>\".\n");
+                return -1;
+        }
+        /* Record the calls for the next requireSnapshot */
+        snapshot.recording = 1;
+        load_commands_wrap();
+        if (!(file = fopen(filename, "r"))) {
+                printf("require: No snapshot %s, loading everything.\n", filename);
+                return 0;
+        }
+        if (!fgets(buffer, sizeof(buffer), file) || strcmp(buffer, SNAPSHOTHEADER) != 0 ||
+            !fgets(buffer, sizeof(buffer), file) || sscanf(buffer, "modules %d", &nmodules) != 1) {
+                fprintf(stderr, "require: %s is not a snapshot for " EPICSVERSION " " T_A ".\n", filename);
+                fclose(file);
+                return -1;
+        }
+        line++;
+        /* Nothing is used before the whole image has been read */
+        nmodules = read_lock(file, filename, &line, nmodules, &modules);
+        if (!fgets(buffer, sizeof(buffer), file) || sscanf(buffer, "calls %d", &n) != 1) {
+                goto corrupt;
+        }
+        while (n-- > 0) {
+                struct load_call *call;
+                char command[64];
+                unsigned long namelen;
+                char *name;
+                int consumed;
+
+                if (!(call = grow(calls, &callssize, ncalls, sizeof(struct load_call)))) {
+                        goto corrupt;
+                }
+                calls = call;
+                call = &calls[ncalls];
+                /* File name and macros are prefixed with their length, they may contain spaces */
+                if (!fgets(buffer, sizeof(buffer), file) ||
+                    sscanf(buffer, "%63s %ld %ld %x %lu%n", command, &call->size, &call->mtime, &call->files, &namelen, &consumed) != 5 ||
+                    buffer[consumed] != ' ' || strlen(buffer + consumed + 1) <= namelen) {
+                        goto corrupt;
+                }
+                name = buffer + consumed + 1;
+                if (name[namelen] != ' ' || sscanf(name + namelen + 1, "%lu%n", &size, &consumed) != 1) {
+                        goto corrupt;
+                }
+                name[namelen] = '\0';
+                p = name + namelen + 1 + consumed;
+                if (*p != ' ' || strlen(p + 1) != size + 1) {
+                        goto corrupt;
+                }
+                p[1 + size] = '\0';
+                call->command = intern(command);
+                call->file = strdup(name);
+                call->macros = size ? strdup(p + 1) : NULL;
+                ncalls++;
+                if (!call->command || !call->file || (size && !call->macros)) {
+                        goto corrupt;
+                }
+        }
+        if (!fgets(buffer, sizeof(buffer), file) || sscanf(buffer, "records %lu", &size) != 1) {
+                goto corrupt;
+        }
+        if (!(records = malloc(size + 1)) || fread(records, 1, size, file) != size) {
+                goto corrupt;
+        }
+        fclose(file);
+
+        registry_lock();
+        use_lock(modules, nmodules);
+        registry_unlock();
+        load_calls_free(snapshot.image, snapshot.nimage);
+        free(snapshot.records);
+        snapshot.records = records;
+        snapshot.recordssize = size;
+        snapshot.image = calls;
+        snapshot.nimage = ncalls;
+        snapshot.next = 0;
+        snapshot.replaying = 1;
+        free(snapshot.filename);
+        snapshot.filename = strdup(filename);
+        if (!hooked) {
+                hooked = 1;
+                initHookRegister(snapshot_init_hook);
+        }
+        printf("require: Read snapshot of %d modules and %d calls from %s.\n", nmodules, ncalls, filename);
+        return 0;
+
+corrupt:
+        fprintf(stderr, "require: Snapshot %s is corrupt.\n", filename);
+        fclose(file);
+        free_lock(modules, nmodules);
+        load_calls_free(calls, ncalls);
+        free(records);
+        return -1;
+}
+
 static const iocshArg requireArg0 = { "module", iocshArgString };
 static const iocshArg requireArg1 = { "version", iocshArgString };
 static const iocshArg * const requireArgs[2] = { &requireArg0, &requireArg1 };
@@ -1190,6 +6553,22 @@ static void requireCallFunc (const iocshArgBuf *args)
     require(args[0].sval, args[1].sval);
 }
 
+static const iocshArg requireManyArg0 = { "module[,version] ...", iocshArgString };
+static const iocshArg * const requireManyArgs[1] = { &requireManyArg0 };
+static const iocshFuncDef requireManyFuncDef = { "requireMany", 1, requireManyArgs };
+static void requireManyCallFunc (const iocshArgBuf *args)
+{
+    requireMany(args[0].sval);
+}
+
+static const iocshArg requireManyFileArg0 = { "file", iocshArgString };
+static const iocshArg * const requireManyFileArgs[1] = { &requireManyFileArg0 };
+static const iocshFuncDef requireManyFileFuncDef = { "requireManyFile", 1, requireManyFileArgs };
+static void requireManyFileCallFunc (const iocshArgBuf *args)
+{
+    requireManyFile(args[0].sval);
+}
+
 static const iocshArg libversionShowArg0 = { "pattern", iocshArgString };
 static const iocshArg * const libversionArgs[1] = { &libversionShowArg0 };
 static const iocshFuncDef libversionShowCallFuncDef = { "libversionShow", 1, libversionArgs };
@@ -1198,12 +6577,34 @@ static void libversionShowCallFunc (const iocshArgBuf *args)
     libversionShow(args[0].sval);
 }
 
+static const iocshFuncDef requireStatsCallFuncDef = { "requireStats", 1, libversionArgs };
+static void requireStatsCallFunc (const iocshArgBuf *args)
+{
+    requireStats(args[0].sval);
+}
+
+static const iocshArg requireLockArg0 = { "lockfile", iocshArgString };
+static const iocshArg * const requireLockArgs[1] = { &requireLockArg0 };
+static const iocshFuncDef requireLockFuncDef = { "requireLock", 1, requireLockArgs };
+static void requireLockCallFunc (const iocshArgBuf *args)
+{
+    requireLock(args[0].sval);
+}
+
+static const iocshFuncDef requireFromLockFuncDef = { "requireFromLock", 1, requireLockArgs };
+static void requireFromLockCallFunc (const iocshArgBuf *args)
+{
+    requireFromLock(args[0].sval);
+}
+
 static const iocshArg ldArg0 = { "library", iocshArgString };
 static const iocshArg * const ldArgs[1] = { &ldArg0 };
 static const iocshFuncDef ldCallFuncDef = { "ld", 1, ldArgs };
 static void ldCallFunc (const iocshArgBuf *args)
 {
+    trace_begin("ld", args[0].sval);
     loadlib(args[0].sval);
+    trace_end();
 }
 
 static const iocshArg dbLoadRecordsTemplateArg0 = { "file name", iocshArgString };
@@ -1212,7 +6613,117 @@ static const iocshArg * const dbLoadRecordsTemplateArgs[2] = { &dbLoadRecordsTem
 static const iocshFuncDef dbLoadRecordsTemplateFuncDef = { "dbLoadRecordsTemplate", 2, dbLoadRecordsTemplateArgs };
 static void dbLoadRecordsTemplateCallFunc (const iocshArgBuf *args)
 {
-    dbLoadRecordsTemplate(args[0].sval, args[1].sval);
+    int status = 0;
+
+    trace_begin("dbLoadRecordsTemplate", args[0].sval);
+    if (!load_call("dbLoadRecordsTemplate", args[0].sval, args[1].sval))
+        status = dbLoadRecordsTemplate(args[0].sval, args[1].sval);
+    trace_end();
+    iocsh_set_error(status);
+}
+
+/*
+ * The commands of EPICS base loading records are only wrapped once
+ * requireFromSnapshot or requireProfile has been called, to record them. The
+ * wrappers keep the definitions of base and call their functions. Without
+ * iocshFindCommand (3.14) or if base has not registered them they are
+ * defined here.
+ */
+static const iocshArg dbLoadRecordsArg0 = { "file name", iocshArgString };
+static const iocshArg dbLoadRecordsArg1 = { "substitutions", iocshArgString };
+static const iocshArg * const dbLoadRecordsArgs[2] = { &dbLoadRecordsArg0, &dbLoadRecordsArg1 };
+static const iocshFuncDef dbLoadRecordsFuncDef = { "dbLoadRecords", 2, dbLoadRecordsArgs };
+
+static const iocshArg dbLoadTemplateArg0 = { "filename", iocshArgString };
+static const iocshArg dbLoadTemplateArg1 = { "var1=value1,var2=value2", iocshArgString };
+static const iocshArg * const dbLoadTemplateArgs[2] = { &dbLoadTemplateArg0, &dbLoadTemplateArg1 };
+static const iocshFuncDef dbLoadTemplateFuncDef = { "dbLoadTemplate", 2, dbLoadTemplateArgs };
+
+static struct load_command {
+    const iocshFuncDef *def;
+    iocshCallFunc func;    /* Of base, NULL if defined here */
+} dbLoadRecordsBase = { &dbLoadRecordsFuncDef, NULL }, dbLoadTemplateBase = { &dbLoadTemplateFuncDef, NULL };
+
+/* Run a wrapped command unless its records come from the snapshot image */
+static void load_command_run(const struct load_command *cmd, const iocshArgBuf *args,
+    int (*load)(const char *file, const char *macros))
+{
+    const char *macros = NULL;
+    int status = 0;
+
+    if (cmd->def->nargs < 1 || cmd->def->arg[0]->type != iocshArgString) {
+        /* Not the command this wraps, leave it to base */
+        if (cmd->func) cmd->func(args);
+        return;
+    }
+    if (cmd->def->nargs > 1 && cmd->def->arg[1]->type == iocshArgString)
+        macros = args[1].sval;
+    if (load_call(cmd->def->name, args[0].sval, macros))
+        return;
+    if (cmd->func) {
+        cmd->func(args);
+        return;
+    }
+    status = load(args[0].sval, macros);
+    iocsh_set_error(status);
+}
+
+static int dbLoadRecordsLoad(const char *file, const char *macros)
+{
+    return dbLoadRecords(file, macros);
+}
+
+static int dbLoadTemplateLoad(const char *file, const char *macros)
+{
+    return dbLoadTemplate(file, macros);
+}
+
+static void dbLoadRecordsCallFunc (const iocshArgBuf *args)
+{
+    load_command_run(&dbLoadRecordsBase, args, dbLoadRecordsLoad);
+}
+
+static void dbLoadTemplateCallFunc (const iocshArgBuf *args)
+{
+    load_command_run(&dbLoadTemplateBase, args, dbLoadTemplateLoad);
+}
+
+static void load_command_wrap(struct load_command *cmd, iocshCallFunc wrapper)
+{
+#if EPICS_VERSION > 3 || (EPICS_VERSION == 3 && EPICS_REVISION >= 15)
+    const iocshCmdDef *base = iocshFindCommand(cmd->def->name);
+
+    if (base && base->func != wrapper) {
+        /* Copy it, registering the wrapper replaces the function in base's entry */
+        cmd->def = base->pFuncDef;
+        cmd->func = base->func;
+    }
+#endif
+    iocshRegister(cmd->def, wrapper);
+}
+
+static void load_commands_wrap(void)
+{
+    static int wrapped = 0;
+
+    if (wrapped) return;
+    wrapped = 1;
+    load_command_wrap(&dbLoadRecordsBase, dbLoadRecordsCallFunc);
+    load_command_wrap(&dbLoadTemplateBase, dbLoadTemplateCallFunc);
+}
+
+static const iocshArg requireSnapshotArg0 = { "imagefile", iocshArgString };
+static const iocshArg * const requireSnapshotArgs[1] = { &requireSnapshotArg0 };
+static const iocshFuncDef requireSnapshotFuncDef = { "requireSnapshot", 1, requireSnapshotArgs };
+static void requireSnapshotCallFunc (const iocshArgBuf *args)
+{
+    requireSnapshot(args[0].sval);
+}
+
+static const iocshFuncDef requireFromSnapshotFuncDef = { "requireFromSnapshot", 1, requireSnapshotArgs };
+static void requireFromSnapshotCallFunc (const iocshArgBuf *args)
+{
+    requireFromSnapshot(args[0].sval);
 }
 
 static const iocshArg requireSnippetArg0 = { "snippet", iocshArgString };
@@ -1221,7 +6732,9 @@ static const iocshArg * const requireSnippetArgs[2] = { &requireSnippetArg0, &re
 static const iocshFuncDef requireSnippetFuncDef = { "requireSnippet", 2, requireSnippetArgs };
 static void requireSnippetCallFunc (const iocshArgBuf *args)
 {
+    trace_begin("requireSnippet", args[0].sval);
     requireSnippet(args[0].sval, args[1].sval);
+    trace_end();
 }
 
 static const iocshArg requireExecArg0 = { "executable", iocshArgString };
@@ -1232,24 +6745,70 @@ static const iocshArg * const requireExecArgs[4] = { &requireExecArg0, &requireE
 static const iocshFuncDef requireExecFuncDef = { "requireExec", 4, requireExecArgs };
 static void requireExecCallFunc (const iocshArgBuf *args)
 {
+    trace_begin("requireExec", args[0].sval);
     requireExec(args[0].sval, args[1].sval, args[2].sval, args[3].sval, 1);
+    trace_end();
+}
+
+static const iocshArg requireTraceArg0 = { "tracefile", iocshArgString };
+static const iocshArg * const requireTraceArgs[1] = { &requireTraceArg0 };
+static const iocshFuncDef requireTraceFuncDef = { "requireTrace", 1, requireTraceArgs };
+static void requireTraceCallFunc (const iocshArgBuf *args)
+{
+    requireTrace(args[0].sval);
+}
+
+static const iocshFuncDef requireTraceWriteFuncDef = { "requireTraceWrite", 1, requireTraceArgs };
+static void requireTraceWriteCallFunc (const iocshArgBuf *args)
+{
+    requireTraceWrite(args[0].sval);
+}
+
+static const iocshArg requireProfileArg0 = { "profilefile", iocshArgString };
+static const iocshArg * const requireProfileArgs[1] = { &requireProfileArg0 };
+static const iocshFuncDef requireProfileFuncDef = { "requireProfile", 1, requireProfileArgs };
+static void requireProfileCallFunc (const iocshArgBuf *args)
+{
+    requireProfile(args[0].sval);
 }
 
 static void requireRegister(void)
 {
     if (firstTime) {
+        char *tracefile = getenv("REQUIRE_TRACE");
+        if (tracefile && tracefile[0]) {
+            requireTrace(tracefile);
+        }
+        char *profilefile = getenv("REQUIRE_PROFILE");
+        if (profilefile && profilefile[0]) {
+            requireProfile(profilefile);
+        }
         firstTime = 0;
         iocshRegister (&ldCallFuncDef, ldCallFunc);
         iocshRegister (&libversionShowCallFuncDef, libversionShowCallFunc);
+        iocshRegister (&requireStatsCallFuncDef, requireStatsCallFunc);
         iocshRegister (&requireCallFuncDef, requireCallFunc);
+        iocshRegister (&requireManyFuncDef, requireManyCallFunc);
+        iocshRegister (&requireManyFileFuncDef, requireManyFileCallFunc);
+        iocshRegister (&requireLockFuncDef, requireLockCallFunc);
+        iocshRegister (&requireFromLockFuncDef, requireFromLockCallFunc);
         iocshRegister (&dbLoadRecordsTemplateFuncDef, dbLoadRecordsTemplateCallFunc);
+        iocshRegister (&requireSnapshotFuncDef, requireSnapshotCallFunc);
+        iocshRegister (&requireFromSnapshotFuncDef, requireFromSnapshotCallFunc);
         iocshRegister (&requireSnippetFuncDef, requireSnippetCallFunc);
+        iocshRegister (&requireTraceFuncDef, requireTraceCallFunc);
+        iocshRegister (&requireTraceWriteFuncDef, requireTraceWriteCallFunc);
+        iocshRegister (&requireProfileFuncDef, requireProfileCallFunc);
 #if defined(__unix__)
         iocshRegister (&requireExecFuncDef, requireExecCallFunc);
 #endif
-        registerExternalModules();
+        /* Registers the external modules */
+        registry_lock();
+        registry_unlock();
     }
 }
 
 epicsExportRegistrar(requireRegister);
 epicsExportAddress(int, requireDebug);
+epicsExportAddress(int, requirePipeline);
+epicsExportAddress(int, requireDbdCache);
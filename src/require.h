@@ -2,9 +2,22 @@
 #define require_h
 
 int require(const char* libname, const char* version);
+int requireMany(const char* list);
+int requireManyFile(const char* filename);
 int requireExec(const char *executable, const char *args, const char *outfile, const char *assertNoPath, int fork);
 const char* getLibVersion(const char* libname);
+const char* getLibLocation(const char* libname);
+int requireVersionMatch(const char* spec, const char* version);
+int requireVersionCompare(const char* a, const char* b);
 int libversionShow(const char* pattern);
+int requireStats(const char* pattern);
+int requireLock(const char* filename);
+int requireFromLock(const char* filename);
+int requireSnapshot(const char* filename);
+int requireFromSnapshot(const char* filename);
+int requireTrace(const char* filename);
+int requireTraceWrite(const char* filename);
+int requireProfile(const char* filename);
 
 /* Private function is exposed since 'require' will terminate the application */
 int require_priv(const char* module, const char* vers);
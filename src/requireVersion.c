@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+
+#include "require.h"
+
+#ifndef VERSION
+#define VERSION "unknown"
+#endif
+
+static int highestFlag;
+
+void usage() {
+
+        printf("Usage: requireVersion [options] <requirement> [<version> ...]\n");
+        printf("\n");
+        printf("Print the versions which match the requirement, lowest first.\n");
+        printf("Exits with 0 if any version matches, 1 if none matches and 2 if\n");
+        printf("the requirement is invalid. The requirement syntax is the one of\n");
+        printf("require and dependency files, see README.\n");
+        printf("\n");
+        printf("Options:\n");
+        printf("  -H, --highest      print only the highest matching version\n");
+        printf("  -h, --help         show this help message and exit\n");
+        printf("  -V, --version      show version and exit\n");
+        printf("\n");
+        printf("Examples:\n");
+        printf("  requireVersion 4.31+ 4.30.0 4.31.2 4.32.0 5.0.0\n");
+        printf("  requireVersion -H '^1.2' $(ls $EPICS_MODULES_PATH/asyn)\n");
+        printf("\n");
+
+}
+
+void version() {
+        printf("requireVersion " VERSION "\n");
+}
+
+static int compare(const void *a, const void *b) {
+        return requireVersionCompare(*(const char * const *)a, *(const char * const *)b);
+}
+
+int main(int argc, char *argv[]){
+        int c;
+        for(;;){
+                static struct option long_options[] =
+                {
+                        {"highest", no_argument, &highestFlag, 1},
+                        {"help",    no_argument, 0, 'h'},
+                        {"version", no_argument, 0, 'V'},
+                        {0, 0, 0, 0}
+                };
+                int option_index = 0;
+                c = getopt_long(argc, argv, "HhV", long_options, &option_index);
+                if(c == -1) {
+                        break;
+                }
+                switch(c) {
+                case 'H':
+                        highestFlag = 1;
+                case 0:
+                        /* Option set a flag */
+                        break;
+                case 'h':
+                        usage();
+                        return 0;
+                case '?':
+                        usage();
+                        return 2;
+                case 'V':
+                        version();
+                        return 0;
+                }
+        }
+        if(optind >= argc) {
+                usage();
+                return 2;
+        }
+        const char *spec = argv[optind++];
+        char **versions = argv + optind;
+        int count = argc - optind;
+        int i, n = 0;
+
+        if(requireVersionMatch(spec, "0.0.0") < 0) {
+                fprintf(stderr, "requireVersion: Invalid requirement %s\n", spec);
+                return 2;
+        }
+        for(i = 0; i < count; i++) {
+                if(requireVersionMatch(spec, versions[i]) == 1) {
+                        versions[n++] = versions[i];
+                }
+        }
+        qsort(versions, n, sizeof(char *), compare);
+        for(i = highestFlag && n > 0 ? n - 1 : 0; i < n; i++) {
+                printf("%s\n", versions[i]);
+        }
+        return n > 0 ? 0 : 1;
+}
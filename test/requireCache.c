@@ -0,0 +1,319 @@
+/*
+ * Test of the read-through module cache.
+ *
+ * A generated module tree stands in for a tree on NFS. It is bind mounted to
+ * a second path in a private mount namespace, like a remote file system with
+ * its own mount point, and the module is required from there with
+ * REQUIRE_MODULE_CACHE set, each boot in a new process:
+ *   cold      the module is copied to the cache and loaded from the copy
+ *   hit       the copy is used, the files in the tree are not read
+ *   replaced  a library file overwritten in place is copied again
+ *   changed   a file added to the tree gives a new copy
+ *   evicted   a cache over its size loses the least recently used copy
+ * Without permission to create a mount namespace the tree is used directly.
+ *
+ * Usage: requireCache [<tmpdir>]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* nftw, unshare */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <ftw.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <epicsTime.h>
+#include <epicsExport.h>
+
+#include "require.h"
+
+#ifndef EPICSVERSION
+#error EPICSVERSION must be defined
+#endif
+#ifndef T_A
+#error T_A must be defined
+#endif
+
+extern REGISTRAR pvar_func_requireRegister;
+
+static char root[256], tree[300], mnt[300], cachedir[300];
+static int failures;
+
+static int make_dirs(char *path)
+{
+        char *p;
+
+        for (p = path + 1; *p; p++)
+        {
+                if (*p != '/') continue;
+                *p = '\0';
+                if (mkdir(path, 0777) != 0 && access(path, F_OK) != 0) return -1;
+                *p = '/';
+        }
+        return mkdir(path, 0777) != 0 && access(path, F_OK) != 0 ? -1 : 0;
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf)
+{
+        return remove(path);
+}
+
+static int write_file(const char *path, const char *text)
+{
+        FILE *file;
+
+        if (!(file = fopen(path, "w"))) return -1;
+        fputs(text, file);
+        return fclose(file);
+}
+
+/*
+ * Date path back by age seconds. The cache does not copy a module version
+ * modified within the last second.
+ */
+static void age(const char *path, int age)
+{
+        struct timeval times[2];
+
+        gettimeofday(&times[0], NULL);
+        times[0].tv_sec -= age;
+        times[0].tv_usec = 0;
+        times[1] = times[0];
+        utimes(path, times);
+}
+
+/*
+ * Module c version 1.0.0 with a library dependency file, a template and a
+ * startup script.
+ */
+static int make_tree(void)
+{
+        char path[512];
+        const char *dirs[] = {
+                "/db", "/startup", "/" EPICSVERSION "/lib/" T_A, "/" EPICSVERSION, "", "/..",
+        };
+        int i;
+
+        snprintf(path, sizeof(path), "%s/c/1.0.0/" EPICSVERSION "/lib/" T_A, tree);
+        if (make_dirs(path) != 0) return -1;
+        snprintf(path, sizeof(path), "%s/c/1.0.0/" EPICSVERSION "/lib/" T_A "/c.dep", tree);
+        if (write_file(path, "") != 0) return -1;
+        snprintf(path, sizeof(path), "%s/c/1.0.0/db", tree);
+        if (make_dirs(path) != 0) return -1;
+        snprintf(path, sizeof(path), "%s/c/1.0.0/db/c.template", tree);
+        if (write_file(path, "record(ai,\"$(P)\") {}\n") != 0) return -1;
+        snprintf(path, sizeof(path), "%s/c/1.0.0/startup", tree);
+        if (make_dirs(path) != 0) return -1;
+        snprintf(path, sizeof(path), "%s/c/1.0.0/startup/c.cmd", tree);
+        if (write_file(path, "dbLoadRecords c.template P=TEST\n") != 0) return -1;
+        for (i = 0; i < (int)(sizeof(dirs)/sizeof(dirs[0])); i++)
+        {
+                snprintf(path, sizeof(path), "%s/c/1.0.0%s", tree, dirs[i]);
+                age(path, 100);
+        }
+        return 0;
+}
+
+/*
+ * Make mnt a bind mount of tree in a new mount namespace, owned by a new
+ * user namespace unless running as root. Returns -1 if not permitted.
+ */
+static int bind_tree(void)
+{
+        char map[64];
+        uid_t uid = getuid();
+        gid_t gid = getgid();
+        int fd;
+
+        if (unshare(uid == 0 ? CLONE_NEWNS : CLONE_NEWUSER | CLONE_NEWNS) != 0) return -1;
+        if (uid != 0)
+        {
+                if ((fd = open("/proc/self/setgroups", O_WRONLY)) >= 0)
+                {
+                        if (write(fd, "deny", 4) != 4) {}
+                        close(fd);
+                }
+                snprintf(map, sizeof(map), "0 %d 1", (int)uid);
+                if ((fd = open("/proc/self/uid_map", O_WRONLY)) < 0) return -1;
+                if (write(fd, map, strlen(map)) != (ssize_t)strlen(map)) { close(fd); return -1; }
+                close(fd);
+                snprintf(map, sizeof(map), "0 %d 1", (int)gid);
+                if ((fd = open("/proc/self/gid_map", O_WRONLY)) < 0) return -1;
+                if (write(fd, map, strlen(map)) != (ssize_t)strlen(map)) { close(fd); return -1; }
+                close(fd);
+        }
+        /* Keep the bind mount out of the namespace of the caller */
+        if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) return -1;
+        if (mkdir(mnt, 0777) != 0 && errno != EEXIST) return -1;
+        return mount(tree, mnt, NULL, MS_BIND, NULL);
+}
+
+static void fail(const char *step, const char *message, const char *arg)
+{
+        fprintf(stderr, "requireCache: %s: ", step);
+        fprintf(stderr, message, arg);
+        fprintf(stderr, "\n");
+        failures++;
+}
+
+/*
+ * Require c in a new process and check that it comes from the cache entry
+ * expected, or from a new one if expected is empty, which is then filled in.
+ */
+static void boot(const char *step, const char *modules, char *expected, size_t size)
+{
+        char location[512] = "";
+        epicsTimeStamp start, end;
+        int pipefd[2];
+        ssize_t n;
+        pid_t pid;
+        int status;
+
+        fflush(stdout);
+        if (pipe(pipefd) != 0 || (pid = fork()) < 0)
+        {
+                fail(step, "can't run %s", strerror(errno));
+                return;
+        }
+        if (pid == 0)
+        {
+                const char *path;
+                close(pipefd[0]);
+                setenv("EPICS_MODULES_PATH", modules, 1);
+                setenv("REQUIRE_MODULE_CACHE", cachedir, 1);
+                pvar_func_requireRegister();
+                epicsTimeGetCurrent(&start);
+                if (require_priv("c", "1.0.0") != 0) _exit(1);
+                epicsTimeGetCurrent(&end);
+                if (!(path = getLibLocation("c"))) _exit(1);
+                printf("%-8s %9.3f ms %s\n", step, epicsTimeDiffInSeconds(&end, &start) * 1000, path);
+                fflush(stdout);
+                if (write(pipefd[1], path, strlen(path)) != (ssize_t)strlen(path)) _exit(1);
+                _exit(0);
+        }
+        close(pipefd[1]);
+        n = read(pipefd[0], location, sizeof(location) - 1);
+        close(pipefd[0]);
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || n <= 0)
+        {
+                fail(step, "require failed%s", "");
+                return;
+        }
+        location[n] = '\0';
+        if (strncmp(location, cachedir, strlen(cachedir)) != 0)
+        {
+                fail(step, "loaded from %s, not from the cache", location);
+        }
+        else if (expected[0] && strcmp(location, expected) != 0)
+        {
+                fail(step, "loaded from %s", location);
+        }
+        else if (!expected[0])
+        {
+                if (size) snprintf(expected, size, "%s", location);
+        }
+}
+
+static int same_file(const char *a, const char *b)
+{
+        char bufa[256], bufb[256];
+        FILE *fa, *fb;
+        size_t na = 0, nb = 0;
+
+        if ((fa = fopen(a, "r"))) { na = fread(bufa, 1, sizeof(bufa), fa); fclose(fa); }
+        if ((fb = fopen(b, "r"))) { nb = fread(bufb, 1, sizeof(bufb), fb); fclose(fb); }
+        return fa && fb && na == nb && memcmp(bufa, bufb, na) == 0;
+}
+
+int main(int argc, char **argv)
+{
+        char first[512] = "", second[512] = "", again[512];
+        char path[600], copy[600];
+        const char *modules;
+        struct stat filestat;
+
+        snprintf(root, sizeof(root), "%s/requireCacheXXXXXX", argc > 1 ? argv[1] : "/tmp");
+        if (!mkdtemp(root))
+        {
+                perror("requireCache: cannot create directory");
+                return 1;
+        }
+        snprintf(tree, sizeof(tree), "%s/remote", root);
+        snprintf(mnt, sizeof(mnt), "%s/mnt", root);
+        snprintf(cachedir, sizeof(cachedir), "%s/cache", root);
+        if (make_dirs(cachedir) != 0 || make_tree() != 0)
+        {
+                perror("requireCache: cannot create module tree");
+                return 1;
+        }
+        if (bind_tree() == 0)
+        {
+                modules = mnt;
+        }
+        else
+        {
+                printf("requireCache: can't bind mount (%s), using the tree directly\n", strerror(errno));
+                modules = tree;
+        }
+
+        boot("cold", modules, first, sizeof(first));
+        snprintf(path, sizeof(path), "%s/c/1.0.0/db/c.template", tree);
+        snprintf(copy, sizeof(copy), "%s/db/c.template", first);
+        if (first[0] && !same_file(path, copy)) fail("cold", "%s not copied", copy);
+
+        /* Rewriting a file in place leaves the directories as they were */
+        write_file(path, "record(ao,\"$(P)\") {}\n");
+        age(path, 100);
+        snprintf(again, sizeof(again), "%s", first);
+        boot("hit", modules, again, 0);
+        if (first[0] && same_file(path, copy)) fail("hit", "%s read from the tree", path);
+
+        /* Libraries and dbd files are checked one by one */
+        snprintf(path, sizeof(path), "%s/c/1.0.0/" EPICSVERSION "/lib/" T_A "/c.dep", tree);
+        write_file(path, "# none\n");
+        age(path, 100);
+        boot("replaced", modules, again, 0);
+        snprintf(copy, sizeof(copy), "%s/" EPICSVERSION "/lib/" T_A "/c.dep", first);
+        if (first[0] && !same_file(path, copy)) fail("replaced", "%s not copied again", copy);
+
+        snprintf(path, sizeof(path), "%s/c/1.0.0/db/c2.template", tree);
+        write_file(path, "record(bi,\"$(P)\") {}\n");
+        snprintf(path, sizeof(path), "%s/c/1.0.0/db", tree);
+        age(path, 50);
+        boot("changed", modules, second, sizeof(second));
+        if (first[0] && strcmp(first, second) == 0) fail("changed", "%s used again", first);
+        snprintf(copy, sizeof(copy), "%s/db/c2.template", second);
+        if (second[0] && access(copy, F_OK) != 0) fail("changed", "%s not copied", copy);
+
+        /* The first copy was last used long ago, the second just now */
+        snprintf(path, sizeof(path), "%s/.require.cache", first);
+        age(path, 7200);
+        snprintf(path, sizeof(path), "%s/c/1.0.0/db/c3.template", tree);
+        write_file(path, "record(bo,\"$(P)\") {}\n");
+        snprintf(path, sizeof(path), "%s/c/1.0.0/db", tree);
+        age(path, 20);
+        setenv("REQUIRE_MODULE_CACHE_SIZE", "0", 1);
+        again[0] = '\0';
+        boot("evicted", modules, again, sizeof(again));
+        if (first[0] && stat(first, &filestat) == 0) fail("evicted", "%s not evicted", first);
+        if (second[0] && stat(second, &filestat) != 0) fail("evicted", "%s evicted", second);
+
+        if (modules == mnt) umount(mnt);
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        if (failures)
+        {
+                printf("requireCache: %d failures\n", failures);
+                return 1;
+        }
+        printf("requireCache: ok\n");
+        return 0;
+}
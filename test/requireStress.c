@@ -0,0 +1,223 @@
+/*
+ * Stress test for the module registry.
+ *
+ * Four threads require disjoint sets of modules from a generated module tree
+ * while four other threads keep looking modules up with getLibVersion() and
+ * one keeps listing them with requireStats() and libversionShow(). A lookup
+ * must either find nothing or the complete module, and all modules must be
+ * registered in the end. Run it under ThreadSanitizer to check the registry
+ * for data races. The messages of require go to /dev/null.
+ *
+ * Usage: requireStress [<tmpdir>]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* nftw */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsExport.h>
+
+#include "require.h"
+
+#define MODULES 150
+#define VERSIONS 8
+#define WRITERS 4
+#define READERS 4
+#define LISTERS 1
+
+#ifndef EPICSVERSION
+#error EPICSVERSION must be defined
+#endif
+#ifndef T_A
+#error T_A must be defined
+#endif
+
+extern REGISTRAR pvar_func_requireRegister;
+
+static epicsMutexId doneLock;
+static int done;
+static int failures;
+static epicsEventId finished[WRITERS + READERS + LISTERS];
+
+static int make_dirs(char *path)
+{
+        char *p;
+
+        for (p = path + 1; *p; p++)
+        {
+                if (*p != '/') continue;
+                *p = '\0';
+                if (mkdir(path, 0777) != 0 && access(path, F_OK) != 0) return -1;
+                *p = '/';
+        }
+        return mkdir(path, 0777) != 0 && access(path, F_OK) != 0 ? -1 : 0;
+}
+
+/*
+ * Every module m<i> has the versions 1.0.0 to 1.<VERSIONS-1>.0 without a
+ * library, which is enough to be found and registered.
+ */
+static int make_tree(const char *root)
+{
+        char path[512];
+        FILE *dep;
+        int i, j;
+
+        for (i = 0; i < MODULES; i++)
+        {
+                for (j = 0; j < VERSIONS; j++)
+                {
+                        snprintf(path, sizeof(path), "%s/m%d/1.%d.0/db", root, i, j);
+                        if (make_dirs(path) != 0) return -1;
+                        snprintf(path, sizeof(path), "%s/m%d/1.%d.0/" EPICSVERSION "/lib/" T_A, root, i, j);
+                        if (make_dirs(path) != 0) return -1;
+                        snprintf(path, sizeof(path), "%s/m%d/1.%d.0/" EPICSVERSION "/lib/" T_A "/m%d.dep", root, i, j, i);
+                        if (!(dep = fopen(path, "w"))) return -1;
+                        fclose(dep);
+                }
+        }
+        return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftwbuf)
+{
+        return remove(path);
+}
+
+static int is_done(void)
+{
+        int d;
+
+        epicsMutexMustLock(doneLock);
+        d = done;
+        epicsMutexUnlock(doneLock);
+        return d;
+}
+
+static void fail(const char *format, const char *arg)
+{
+        fprintf(stderr, format, arg);
+        epicsMutexMustLock(doneLock);
+        failures++;
+        epicsMutexUnlock(doneLock);
+}
+
+static void writer(void *arg)
+{
+        int n = (int)(size_t)arg;
+        char name[16];
+        int i;
+
+        for (i = n; i < MODULES; i += WRITERS)
+        {
+                snprintf(name, sizeof(name), "m%d", i);
+                if (require_priv(name, NULL) != 0) fail("requireStress: require %s failed\n", name);
+        }
+        epicsEventSignal(finished[n]);
+}
+
+static void reader(void *arg)
+{
+        int n = (int)(size_t)arg;
+        const char *version;
+        char name[16];
+        int i = 0;
+
+        while (!is_done())
+        {
+                snprintf(name, sizeof(name), "m%d", i++ % MODULES);
+                version = getLibVersion(name);
+                if (version && strncmp(version, "1.", 2) != 0) fail("requireStress: bad version %s\n", version);
+        }
+        epicsEventSignal(finished[WRITERS + n]);
+}
+
+static void lister(void *arg)
+{
+        int n = (int)(size_t)arg;
+
+        while (!is_done())
+        {
+                requireStats(NULL);
+                libversionShow("m1");
+        }
+        epicsEventSignal(finished[WRITERS + READERS + n]);
+}
+
+int main(int argc, char **argv)
+{
+        char root[256];
+        char name[16];
+        FILE *out;
+        int i;
+
+        snprintf(root, sizeof(root), "%s/requireStressXXXXXX", argc > 1 ? argv[1] : "/tmp");
+        if (!mkdtemp(root) || make_tree(root) != 0)
+        {
+                perror("requireStress: cannot create module tree");
+                return 1;
+        }
+        setenv("EPICS_MODULES_PATH", root, 1);
+        out = fdopen(dup(1), "w");
+        if (!out || !freopen("/dev/null", "w", stdout))
+        {
+                perror("requireStress: cannot redirect output");
+                return 1;
+        }
+        pvar_func_requireRegister();
+
+        doneLock = epicsMutexMustCreate();
+        for (i = 0; i < WRITERS + READERS + LISTERS; i++)
+        {
+                finished[i] = epicsEventMustCreate(epicsEventEmpty);
+        }
+        for (i = 0; i < READERS; i++)
+        {
+                epicsThreadCreate("reader", epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackSmall), reader, (void *)(size_t)i);
+        }
+        for (i = 0; i < LISTERS; i++)
+        {
+                epicsThreadCreate("lister", epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackSmall), lister, (void *)(size_t)i);
+        }
+        for (i = 0; i < WRITERS; i++)
+        {
+                epicsThreadCreate("writer", epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackMedium), writer, (void *)(size_t)i);
+        }
+        for (i = 0; i < WRITERS; i++)
+        {
+                epicsEventMustWait(finished[i]);
+        }
+        epicsMutexMustLock(doneLock);
+        done = 1;
+        epicsMutexUnlock(doneLock);
+        for (i = 0; i < READERS + LISTERS; i++)
+        {
+                epicsEventMustWait(finished[WRITERS + i]);
+        }
+
+        for (i = 0; i < MODULES; i++)
+        {
+                snprintf(name, sizeof(name), "m%d", i);
+                if (!getLibVersion(name)) fail("requireStress: %s missing\n", name);
+        }
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        if (failures)
+        {
+                fprintf(out, "requireStress: %d failures\n", failures);
+                return 1;
+        }
+        fprintf(out, "requireStress: %d modules required, ok\n", MODULES);
+        return 0;
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/env python2.7
+""" Checks the version requirement rules against the conformance table in
+versions.txt, once with the requireVersion tool and once with the Python
+rules of check_excludes.py, which scripts use when the tool is not installed.
+
+The tool is taken from $REQUIRE_VERSION_TOOL or ../bin/<arch>/requireVersion,
+check_excludes.py from this folder, where the build installs it, or ../scripts.
+
+Usage: requireVersionTable.py [<table>]
+"""
+
+from __future__ import print_function
+import glob
+import os
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path[:0] = [HERE, os.path.join(HERE, '..', 'scripts')]
+import check_excludes
+
+def read_table(filename):
+    """Return the rows of the table as (line number, requirement, version, result)."""
+    rows = []
+    with open(filename) as table:
+        for number, line in enumerate(table, 1):
+            fields = line.split('#', 1)[0].split()
+            if not fields:
+                continue
+            if len(fields) != 3 or fields[2] not in ('yes', 'no', 'invalid'):
+                raise ValueError('{}:{}: bad line'.format(filename, number))
+            spec = '' if fields[0] == '-' else fields[0]
+            rows.append((number, spec, fields[1], fields[2]))
+    return rows
+
+def tool_result(tool, spec, version):
+    """Result of the requireVersion tool for one row."""
+    with open(os.devnull, 'w') as devnull:
+        status = subprocess.call([tool, '--', spec, version], stdout=devnull, stderr=devnull)
+    return {0: 'yes', 1: 'no', 2: 'invalid'}.get(status, 'exit status {}'.format(status))
+
+def python_result(spec, version):
+    """Result of the Python rules in check_excludes.py for one row."""
+    try:
+        compiled = check_excludes.compile_version(spec)
+    except ValueError:
+        return 'invalid'
+    return 'yes' if check_excludes.version_in_range(compiled, version) else 'no'
+
+def find_tool():
+    """The requireVersion tool to check, or None."""
+    if os.environ.get('REQUIRE_VERSION_TOOL'):
+        return os.environ['REQUIRE_VERSION_TOOL']
+    tools = glob.glob(os.path.join(HERE, '..', 'bin', '*', 'requireVersion'))
+    return tools[0] if tools else None
+
+def main():
+    """Main function"""
+    rows = read_table(sys.argv[1] if len(sys.argv) > 1 else os.path.join(HERE, 'versions.txt'))
+    tool = find_tool()
+    failures = 0
+    if not tool:
+        print('requireVersionTable: requireVersion not found')
+        failures += 1
+    checks = [('python', python_result)]
+    if tool:
+        checks.insert(0, ('requireVersion', lambda spec, version: tool_result(tool, spec, version)))
+    for name, check in checks:
+        for number, spec, version, expected in rows:
+            result = check(spec, version)
+            if result != expected:
+                print('requireVersionTable: line {}: {} gives {} for "{}" {}, expected {}'.format(
+                    number, name, result, spec, version, expected))
+                failures += 1
+    print('requireVersionTable: {} rows, {} failures'.format(len(rows), failures))
+    return 1 if failures else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,30 @@
+#!/bin/bash
+#
+# Run the tests of the require module. The tests are installed next to this
+# script by the module build, call it from there:
+#   <module>/<version>/test/runtests.sh [<test>...]
+# Without arguments all tests are run. Exits with the number of failed tests.
+
+TESTS="requireStress requireCache requireVersionTable.py"
+
+cd "$(dirname "$0")" || exit 1
+export TMPDIR=${TMPDIR:-/tmp}
+
+failed=0
+for test in ${@:-$TESTS}
+do
+    echo "=== $test"
+    case $test in
+        *.sh) bash "./$test" ;;
+        *.py) python "./$test" ;;
+        *) "./$test" "$TMPDIR" ;;
+    esac
+    if [ $? -eq 0 ]
+    then
+        echo "--- $test ok"
+    else
+        echo "--- $test FAILED"
+        failed=$((failed+1))
+    fi
+done
+exit $failed